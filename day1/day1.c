@@ -1,48 +1,253 @@
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "../utils/da.h"
+#include "../utils/file.h"
+#include "../utils/numbers.h"
+#include "../utils/perf_measure.h"
+#include "../utils/scan.h"
+#include "../utils/threadpool.h"
 
 #define ROTOR_SIZE 100
 #define ROTOR_INITIAL_POS 50
 
-#define LOGGER_ENABLED 0
-#define log(...) if (LOGGER_ENABLED) printf(__VA_ARGS__)
-#define log_value(val, fmt) if (LOGGER_ENABLED) printf(" %s = "fmt, #val, (val))
-#define print_value(val, fmt) printf("%s = "fmt"\n", #val, (val))
+// Bytes of rotations per threadpool task
+#define CHUNK_BYTES (1u << 20)
+
+/*
+ * The rotor position is a prefix sum mod ROTOR_SIZE, so everything a chunk
+ * contributes is a function of the position it starts at. A chunk is
+ * summarized once for all ROTOR_SIZE starts, then the summaries are chained
+ * in order.
+ */
+typedef struct {
+  const unsigned char *begin;
+  const unsigned char *end;
+  int shift; // net rotation mod ROTOR_SIZE
+  uint64_t clicks[ROTOR_SIZE];
+  uint64_t stops[ROTOR_SIZE];
+} Chunk;
+
+// Room for the deltas of [begin, end), every rotation is at least 2 bytes
+static inline size_t deltas_cap(const unsigned char *begin,
+                                const unsigned char *end) {
+  return (size_t)(end - begin) / 2 + 1;
+}
+
+// One "L68" line, anything not starting with L or R is skipped. The number
+// is read against the buffer end rather than the line end, so the 8 byte
+// parser applies to short lines too and stops at the newline by itself.
+// Every full turn passes zero once wherever it starts, so full turns go
+// straight to *turns and only the remainder is kept as the delta, which
+// keeps |delta| < ROTOR_SIZE for any magnitude.
+static inline size_t decode_line(const unsigned char *line,
+                                 const unsigned char *eol,
+                                 const unsigned char *end, int32_t *delta,
+                                 uint64_t *turns) {
+  if (line >= eol || (*line != 'L' && *line != 'R'))
+    return 0;
+  int32_t neg = -(int32_t)(*line == 'L');
+  unsigned char *q = (unsigned char *)line + 1;
+  uint64_t quant = 0;
+  if (!parse_uint_swar(&q, (unsigned char *)end, &quant))
+    return 0;
+  *turns += quant / ROTOR_SIZE;
+  int32_t rem = (int32_t)(quant % ROTOR_SIZE);
+  *delta = (rem ^ neg) - neg;
+  return 1;
+}
+
+/*
+ * Decodes "L68\nR48\n..." into signed deltas, returns how many and adds the
+ * full turns to *turns. Line ends are found 64 bytes at a time as a bit
+ * mask, so every line is parsed on its own instead of waiting for the end of
+ * the previous number.
+ */
+size_t decode_rotations(const unsigned char *begin, const unsigned char *end,
+                        int32_t *deltas, uint64_t *turns) {
+  const unsigned char *line = begin;
+  const unsigned char *block = begin;
+  size_t n = 0;
+  for (; end - block >= 64; block += 64) {
+    uint64_t mask = scan_byte64(block, '\n');
+    while (mask) {
+      const unsigned char *eol = block + __builtin_ctzll(mask);
+      n += decode_line(line, eol, end, &deltas[n], turns);
+      line = eol + 1;
+      mask &= mask - 1;
+    }
+  }
+  for (; block < end; ++block) {
+    if (*block == '\n') {
+      n += decode_line(line, block, end, &deltas[n], turns);
+      line = block + 1;
+    }
+  }
+  n += decode_line(line, end, end, &deltas[n], turns);
+  return n;
+}
+
+// floor(x / ROTOR_SIZE) for any sign
+static inline int32_t floor_div(int32_t x) {
+  return (x - ((ROTOR_SIZE - 1) & (x >> 31))) / ROTOR_SIZE;
+}
+
+/*
+ * Serial kernel. Going from a to b = a + d the rotor passes the multiples of
+ * ROTOR_SIZE in (a, b] when turning right and in [b, a) when turning left,
+ * both counts are a difference of floors and the sign of d selects one.
+ */
+void rotate(const int32_t *deltas, size_t n, int *rotor, uint64_t *clicks,
+            uint64_t *stops) {
+  int32_t a = *rotor;
+  uint64_t c = 0, s = 0;
+  for (size_t i = 0; i < n; ++i) {
+    int32_t d = deltas[i];
+    int32_t b = a + d;
+    int32_t neg = d >> 31;
+    int32_t fb = floor_div(b);
+    int32_t right = fb;
+    int32_t left = -(int32_t)(a == 0) - floor_div(b - 1);
+    c += (uint64_t)(uint32_t)((right & ~neg) | (left & neg));
+    a = b - fb * ROTOR_SIZE;
+    s += a == 0;
+  }
+  *rotor = a;
+  *clicks += c;
+  *stops += s;
+}
+
+/*
+ * Full turns are counted at decode, so a rotation of |d| < ROTOR_SIZE passes
+ * zero at most once, when m = |d| reaches it. Relative to the chunk start s
+ * the position is (s + p) % ROTOR_SIZE, where p is the rotation so far, so
+ * the extra click happens for exactly m consecutive values of s: a
+ * difference array covers all starts at once. It is twice as long so the
+ * interval never wraps, the halves are folded after.
+ */
+void summarize(Chunk *c, const int32_t *deltas, size_t n, uint64_t turns) {
+  int64_t diff[2 * ROTOR_SIZE + 1] = {0};
+  uint64_t hist[ROTOR_SIZE] = {0};
+  int32_t p = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    int32_t d = deltas[i];
+    int32_t neg = d >> 31;
+    int32_t m = (d ^ neg) - neg;
+    // left: (s + p) % ROTOR_SIZE in [1, m]
+    // right: (s + p) % ROTOR_SIZE >= ROTOR_SIZE - m
+    int32_t from_left = (ROTOR_SIZE + 1 - p) % ROTOR_SIZE;
+    int32_t from_right = (2 * ROTOR_SIZE - m - p) % ROTOR_SIZE;
+    int32_t from = (from_left & neg) | (from_right & ~neg);
+    diff[from]++;
+    diff[from + m]--;
+    p += d;
+    p -= floor_div(p) * ROTOR_SIZE;
+    hist[p]++;
+  }
+
+  int64_t prefix[2 * ROTOR_SIZE];
+  int64_t run = 0;
+  for (int i = 0; i < 2 * ROTOR_SIZE; ++i) {
+    run += diff[i];
+    prefix[i] = run;
+  }
+  for (int s = 0; s < ROTOR_SIZE; ++s) {
+    c->clicks[s] = turns + (uint64_t)(prefix[s] + prefix[s + ROTOR_SIZE]);
+    c->stops[s] = hist[(ROTOR_SIZE - s) % ROTOR_SIZE];
+  }
+  c->shift = p;
+}
+
+static void chunk_job(void *arg) {
+  Chunk *c = (Chunk *)arg;
+  int32_t *deltas = make(int32_t, deltas_cap(c->begin, c->end));
+  uint64_t turns = 0;
+  size_t n = decode_rotations(c->begin, c->end, deltas, &turns);
+  summarize(c, deltas, n, turns);
+  da_free(deltas);
+}
 
 int main(int argc, char *argv[]) {
-	if (argc < 2) {
-        fprintf(stderr, "Usage: %s <file_input>\n", argv[0]);
-		return EXIT_FAILURE;
-	}
-	FILE *f = fopen(argv[1], "r");
-	if (f == NULL) {
-		perror("Error opening file");
-		return EXIT_FAILURE;
-	}
-
-	int rotor = ROTOR_INITIAL_POS;
-	size_t zero_clicks = 0;
-	size_t zero_stops = 0;
-
-	char line[6];
-	while (fgets(line, sizeof(line), f)) {
-		int initial_zero = rotor == 0;
-		char action = line[0];
-		int quant = atoi(&line[1]);
-		if (action == 'L') quant *= -1;
-		rotor += quant;
-		// case change + overflows
-		zero_clicks += (rotor <= 0 && !initial_zero) + abs(rotor / ROTOR_SIZE);
-		rotor = (rotor % ROTOR_SIZE + ROTOR_SIZE) % ROTOR_SIZE;
-		if (rotor == 0) zero_stops++;
-		log_value(quant, "%03d");
-		log_value(rotor, "%02d");
-		log_value(zero_stops, "%04zu");
-		log_value(zero_clicks, "%04zu");
-		log_value(line, "%s");
-	}
-	print_value(zero_clicks, "%zu");
-	print_value(zero_stops, "%zu");
-	fclose(f);
-	return EXIT_SUCCESS;
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <file_input>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  unsigned char *data = NULL;
+  PerfMeasureLoopNamed("entire") {
+    PerfMeasureLoopNamed("read") {
+      if (!read_entire_file(argv[1], &data)) {
+        perror("Error opening file");
+        return EXIT_FAILURE;
+      }
+    }
+    DeferLoopEnd(da_free(data)) {
+      log("Read bytes %zu\n", da_len(data));
+      log("CPU level %s\n", cpu_level_name(cpu_level()));
+      const unsigned char *p = data;
+      const unsigned char *end = data + da_len(data);
+
+      // Chunks end right after a newline so no line is split
+      Chunk *chunks = make(Chunk, da_len(data) / CHUNK_BYTES + 1);
+      size_t longest = 0;
+      while (p < end) {
+        const unsigned char *q = end;
+        if ((size_t)(end - p) > CHUNK_BYTES) {
+          q = memchr(p + CHUNK_BYTES, '\n', (size_t)(end - p - CHUNK_BYTES));
+          q = q ? q + 1 : end;
+        }
+        Chunk c = {.begin = p, .end = q};
+        append(chunks, c);
+        if ((size_t)(q - p) > longest)
+          longest = (size_t)(q - p);
+        p = q;
+      }
+      log_value(da_len(chunks), "%zu");
+
+      threadpool_t pool;
+      if (threadpool_init(&pool, 0) != 0) {
+        fprintf(stderr, "Failed to initialize thread pool\n");
+        return EXIT_FAILURE;
+      }
+
+      int rotor = ROTOR_INITIAL_POS;
+      uint64_t zero_clicks = 0;
+      uint64_t zero_stops = 0;
+      if (pool.nthreads == 1 || da_len(chunks) == 1) {
+        // Nothing runs in parallel, tracking the one real start is cheaper
+        // than summarizing all of them
+        threadpool_destroy(&pool);
+        PerfMeasureLoopNamed("serial") {
+          int32_t *deltas = make(int32_t, deltas_cap(data, data + longest));
+          foreach (c, chunks) {
+            size_t n = decode_rotations(c->begin, c->end, deltas, &zero_clicks);
+            rotate(deltas, n, &rotor, &zero_clicks, &zero_stops);
+          }
+          da_free(deltas);
+        }
+      } else {
+        PerfMeasureLoopNamed("summarize") {
+          foreach (c, chunks) {
+            threadpool_submit(&pool, chunk_job, c);
+          }
+          threadpool_destroy(&pool);
+        }
+        PerfMeasureLoopNamed("combine") {
+          foreach (c, chunks) {
+            zero_clicks += c->clicks[rotor];
+            zero_stops += c->stops[rotor];
+            rotor = (rotor + c->shift) % ROTOR_SIZE;
+          }
+        }
+      }
+      print_value(zero_clicks, "%zu");
+      print_value(zero_stops, "%zu");
+      da_free(chunks);
+    } // DeferLoopEnd(da_free(data))
+  } // PerfMeasureLoopNamed("entire")
+  return EXIT_SUCCESS;
 }
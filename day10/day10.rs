@@ -1,16 +1,17 @@
 use std::{
     cmp::Ordering,
-    env,
-    fs::{self, OpenOptions},
-    io::{self, BufWriter, Read, Write},
-    ops::{Add, Index, IndexMut},
-    sync::{Arc, Mutex},
+    env, fs,
+    io::{self, Read},
+    ops::{Add, BitAnd, BitOr, Index, IndexMut, Shl, Shr, Sub},
+    time::Duration,
 };
 
-use advent2025::{debug_println, perf};
-use ahash::{AHashMap, AHashSet};
-use bytemuck::NoUninit;
-use derive_hash_fast::derive_hash_fast_bytemuck;
+use advent2025::{
+    debug_println,
+    journal::{self, Journal},
+    perf,
+};
+use ahash::AHashMap;
 use mimalloc::MiMalloc;
 use rayon::prelude::*;
 
@@ -18,13 +19,11 @@ use rayon::prelude::*;
 static GLOBAL: MiMalloc = MiMalloc;
 
 const VEC10_EMPTY: Vec10 = Vec10([0; 10]);
+const JOURNAL_SYNC: Duration = Duration::from_millis(100);
 
-#[repr(C)]
-#[derive(Debug, Default, Clone, Copy, NoUninit)]
+#[derive(Debug, Default, Clone, Copy)]
 struct Vec10([u16; 10]);
 
-derive_hash_fast_bytemuck!(Vec10);
-
 impl Vec10 {
     fn iter(&self) -> std::slice::Iter<'_, u16> {
         self.0.iter()
@@ -94,37 +93,19 @@ fn main() -> io::Result<()> {
     let args: Vec<String> = env::args().collect();
     let Some(file_path) = args.get(1) else {
         eprintln!(
-            "Usage: {} <file_input>",
+            "Usage: {} <file_input> [--bfs]",
             args.first().map(|s| s.as_str()).unwrap_or("program")
         );
         return Err(io::Error::other("file_input missing"));
     };
+    // The breadth-first search is kept as a reference for the solver
+    let bfs = args.get(2).is_some_and(|a| a == "--bfs");
     let cpus = num_cpus::get();
     debug_println!("cpus = {cpus}");
     rayon::ThreadPoolBuilder::new()
         .num_threads(cpus)
         .build_global()
         .unwrap();
-    let mut outfile = OpenOptions::new()
-        .read(true)
-        .create(true)
-        .append(true)
-        .open("output.txt")?;
-    let done_tasks = {
-        let mut buf = String::new();
-        outfile.read_to_string(&mut buf)?;
-        buf.lines()
-            .map(|line| line.split_once(',').unwrap())
-            .map(|(line, res)| {
-                (
-                    line.parse::<usize>().unwrap(),
-                    res.parse::<usize>().unwrap(),
-                )
-            })
-            .collect::<AHashMap<usize, usize>>()
-    };
-    let writer = Arc::new(Mutex::new(BufWriter::new(outfile)));
-    debug_println!("{done_tasks:?}");
 
     perf!("entire", {
         let data = perf!("read", {
@@ -134,6 +115,28 @@ fn main() -> io::Result<()> {
             buf.replace("-", " ")
         });
 
+        // One record per solved task, id and presses as two u64 LE, so a long
+        // run can be stopped and picked up again. The header is the input's
+        // length and CRC and the solver, results of another input are thrown
+        // away and a --bfs run does not reuse the solver's.
+        let header = [
+            (data.len() as u64).to_le_bytes().as_slice(),
+            &journal::crc32(data.as_bytes()).to_le_bytes(),
+            &[bfs as u8],
+        ]
+        .concat();
+        let (journal, records) = Journal::open("output.journal", &header, JOURNAL_SYNC)?;
+        let done_tasks: AHashMap<usize, u64> = records
+            .iter()
+            .filter(|r| r.len() == 16)
+            .map(|r| {
+                let id = u64::from_le_bytes(r[..8].try_into().unwrap());
+                let res = u64::from_le_bytes(r[8..].try_into().unwrap());
+                (id as usize, res)
+            })
+            .collect();
+        debug_println!("{done_tasks:?}");
+
         let tasks = perf!("parse", {
             data.lines()
                 .enumerate()
@@ -177,34 +180,455 @@ fn main() -> io::Result<()> {
         debug_println!("{tasks:?}");
         let solution: u64 = perf!("full_solution", {
             tasks
-                .into_iter()
-                .map(|t| {
+                .into_par_iter()
+                .map(|t| -> io::Result<u64> {
                     let id = t.id;
-                    let res = perf!("solution", { solve_min_press(t) });
-                    let mut writer = writer.lock().unwrap();
-                    writeln!(writer, "{id},{res}").unwrap();
-                    writer.flush().unwrap();
-                    res
+                    let res = perf!("solution", {
+                        if bfs {
+                            solve_bfs(t)
+                        } else {
+                            solve_min_press(&t)
+                        }
+                    });
+                    // A failed journal stops the run, the rest would not be kept
+                    journal.append([(id as u64).to_le_bytes(), res.to_le_bytes()].concat())?;
+                    Ok(res)
                 })
-                .sum()
+                .try_reduce(|| 0, |a, b| Ok(a + b))?
+                + done_tasks.values().sum::<u64>()
         });
         println!("solution = {solution}");
-    });
-    Ok(())
+        journal.close()
+    })
+}
+
+/// Presses x per button solve the integer system A x = target, A[i][j] = 1
+/// when button j bumps counter i. Fraction-free Gaussian elimination leaves
+/// one row per pivot button,
+///
+///   p * x[pivot] + sum a[f] * x[f] = b
+///
+/// over the free buttons f, so only the free presses are searched and the
+/// pivot presses follow from the rows.
+fn solve_min_press(task: &Task) -> u64 {
+    debug_println!("target = {:?} buttons = {:?}", &task.target, &task.buttons);
+    // Twin buttons are interchangeable and empty ones never help
+    let mut buttons: Vec<Vec10> = Vec::with_capacity(task.buttons.len());
+    for &b in &task.buttons {
+        if b != VEC10_EMPTY && !buttons.contains(&b) {
+            buttons.push(b);
+        }
+    }
+    let n = buttons.len();
+    let mut rows: Vec<Vec<i64>> = (0..10)
+        .map(|i| {
+            let mut row: Vec<i64> = buttons.iter().map(|b| b[i] as i64).collect();
+            row.push(task.target[i] as i64);
+            row
+        })
+        .collect();
+
+    let mut pivots = Vec::new();
+    for col in 0..n {
+        let r = pivots.len();
+        let Some(p) = (r..rows.len()).find(|&i| rows[i][col] != 0) else {
+            continue;
+        };
+        rows.swap(r, p);
+        if rows[r][col] < 0 {
+            rows[r].iter_mut().for_each(|v| *v = -*v);
+        }
+        for i in 0..rows.len() {
+            if i == r || rows[i][col] == 0 {
+                continue;
+            }
+            let (p, q) = (rows[r][col], rows[i][col]);
+            for k in 0..=n {
+                rows[i][k] = rows[i][k] * p - rows[r][k] * q;
+            }
+            let g = rows[i].iter().fold(0, |g, &v| gcd(g, v.unsigned_abs()));
+            if g > 1 {
+                rows[i].iter_mut().for_each(|v| *v /= g as i64);
+            }
+        }
+        pivots.push(col);
+    }
+    if rows[pivots.len()..].iter().any(|row| row[n] != 0) {
+        panic!("Task {} has no solution", task.id);
+    }
+    rows.truncate(pivots.len());
+    let free: Vec<usize> = (0..n).filter(|c| !pivots.contains(c)).collect();
+    debug_println!("pivots = {pivots:?} free = {free:?}");
+
+    let mut rhs = [0; 10];
+    for (b, row) in rhs.iter_mut().zip(&rows) {
+        *b = row[n];
+    }
+    let mut search = FreeSearch {
+        buttons: &buttons,
+        rows: &rows,
+        pivots: &pivots,
+        free: &free,
+        limits: vec![0; free.len()],
+        best: u64::MAX,
+    };
+    search.run(0, task.target, rhs, 0);
+    assert!(search.best != u64::MAX, "Task {} has no solution", task.id);
+    search.best
+}
+
+struct FreeSearch<'a> {
+    buttons: &'a [Vec10],
+    rows: &'a [Vec<i64>],
+    pivots: &'a [usize],
+    free: &'a [usize],
+    limits: Vec<u16>,
+    best: u64,
+}
+
+impl FreeSearch<'_> {
+    /// Branch and bound over the free buttons. `left` is the target minus
+    /// the presses chosen so far and `rhs` the row sides minus theirs.
+    ///
+    /// A button is pressed at most as often as the least of its counters
+    /// left allows. Every press bumps a counter by one, so the largest
+    /// counter left is a lower bound on the presses still needed, and a
+    /// branch ends once a pivot press has to come out negative whatever the
+    /// free buttons still to choose do.
+    fn run(&mut self, depth: usize, left: Vec10, rhs: [i64; 10], cost: u64) {
+        if cost + *left.iter().max().unwrap() as u64 >= self.best {
+            return;
+        }
+        for (&col, limit) in self.free[depth..].iter().zip(&mut self.limits[depth..]) {
+            *limit = left
+                .iter()
+                .zip(self.buttons[col].iter())
+                .filter(|&(_, &b)| b != 0)
+                .map(|(&l, _)| l)
+                .min()
+                .unwrap();
+        }
+        for (row, &b) in self.rows.iter().zip(&rhs) {
+            let reach: i64 = self.free[depth..]
+                .iter()
+                .zip(&self.limits[depth..])
+                .map(|(&col, &limit)| (-row[col]).max(0) * limit as i64)
+                .sum();
+            if b + reach < 0 {
+                return;
+            }
+        }
+        let Some(&col) = self.free.get(depth) else {
+            self.finish(&rhs, cost);
+            return;
+        };
+
+        let limit = self.limits[depth];
+        if depth + 1 == self.free.len() {
+            self.last(col, limit, &rhs, cost);
+            return;
+        }
+        let button = self.buttons[col];
+        let (mut left, mut rhs) = (left, rhs);
+        for x in 0..=limit {
+            self.run(depth + 1, left, rhs, cost + x as u64);
+            if x < limit {
+                for (l, b) in left.0.iter_mut().zip(button.iter()) {
+                    *l -= b;
+                }
+                for (b, row) in rhs.iter_mut().zip(self.rows) {
+                    *b -= row[col];
+                }
+            }
+        }
+    }
+
+    /// The last free button needs no search: the rows keep the pivot presses
+    /// non-negative on one range of x, and the total is linear in x over it,
+    /// so the first x from either end where every pivot divides evenly is
+    /// the best.
+    fn last(&mut self, col: usize, limit: u16, rhs: &[i64; 10], cost: u64) {
+        let (mut lo, mut hi) = (0, limit as i64);
+        for (row, &b) in self.rows.iter().zip(rhs) {
+            let a = row[col];
+            match a.cmp(&0) {
+                Ordering::Greater => hi = hi.min(b.div_euclid(a)),
+                Ordering::Less => lo = lo.max(-b.div_euclid(-a)),
+                Ordering::Equal if b < 0 => return,
+                Ordering::Equal => {}
+            }
+        }
+        let (first, last) = (
+            (lo..=hi).find_map(|x| self.total(rhs, col, x, cost)),
+            (lo..=hi).rev().find_map(|x| self.total(rhs, col, x, cost)),
+        );
+        if let Some(total) = first.min(last) {
+            self.best = self.best.min(total);
+        }
+    }
+
+    /// Presses in total with the free ones chosen, `x` more on `col`, or
+    /// None when a pivot press is negative or fractional
+    fn total(&self, rhs: &[i64; 10], col: usize, x: i64, cost: u64) -> Option<u64> {
+        let mut total = cost + x as u64;
+        for ((row, &pivot), &b) in self.rows.iter().zip(self.pivots).zip(rhs) {
+            let b = b - row[col] * x;
+            if b < 0 || b % row[pivot] != 0 {
+                return None;
+            }
+            total += (b / row[pivot]) as u64;
+        }
+        Some(total)
+    }
+
+    fn finish(&mut self, rhs: &[i64; 10], cost: u64) {
+        if let Some(total) = self.total(rhs, 0, 0, cost) {
+            self.best = self.best.min(total);
+        }
+    }
+}
+
+fn gcd(a: u64, b: u64) -> u64 {
+    if b == 0 { a } else { gcd(b, a % b) }
+}
+
+/// Frontier state packed into one integer, see `Layout`
+trait Packed:
+    Copy
+    + Ord
+    + Send
+    + Sync
+    + From<u16>
+    + Add<Output = Self>
+    + Sub<Output = Self>
+    + BitAnd<Output = Self>
+    + BitOr<Output = Self>
+    + Shl<u32, Output = Self>
+    + Shr<u32, Output = Self>
+{
+    fn byte(self, shift: u32) -> usize;
+}
+
+macro_rules! impl_packed {
+    ($($t:ty),*) => {$(
+        impl Packed for $t {
+            fn byte(self, shift: u32) -> usize {
+                (self >> shift) as u8 as usize
+            }
+        }
+    )*};
+}
+
+impl_packed!(u64, u128);
+
+/// One bit field per counter with a non-zero target, wide enough for the
+/// target plus a guard bit on top. A state within target never carries out
+/// of a field when a button is added, and subtracting it from the target
+/// with all guards set leaves a guard cleared exactly where it went over.
+struct Layout {
+    shifts: [u32; 10],
+    widths: [u32; 10],
+    bits: u32,
+}
+
+impl Layout {
+    fn new(target: &Vec10) -> Self {
+        let mut layout = Layout {
+            shifts: [0; 10],
+            widths: [0; 10],
+            bits: 0,
+        };
+        for (i, &t) in target.iter().enumerate().filter(|&(_, &t)| t != 0) {
+            layout.shifts[i] = layout.bits;
+            layout.widths[i] = u16::BITS - t.leading_zeros() + 1;
+            layout.bits += layout.widths[i];
+        }
+        layout
+    }
+
+    fn pack<K: Packed>(&self, v: &Vec10) -> K {
+        (0..10)
+            .filter(|&i| self.widths[i] != 0)
+            .fold(K::from(0), |acc, i| acc | K::from(v[i]) << self.shifts[i])
+    }
+
+    fn guards<K: Packed>(&self) -> K {
+        (0..10)
+            .filter(|&i| self.widths[i] != 0)
+            .fold(K::from(0), |acc, i| {
+                acc | K::from(1) << (self.shifts[i] + self.widths[i] - 1)
+            })
+    }
+}
+
+/// LSD radix sort on the low `bits`, 8 bits per pass. Passes where every
+/// key has the same byte are skipped.
+fn radix_sort<K: Packed>(keys: &mut Vec<K>, bits: u32) {
+    if keys.len() < 2 {
+        return;
+    }
+    let mut tmp = vec![K::from(0); keys.len()];
+    for shift in (0..bits).step_by(8) {
+        let mut counts = [0usize; 256];
+        for &k in keys.iter() {
+            counts[k.byte(shift)] += 1;
+        }
+        if counts[keys[0].byte(shift)] == keys.len() {
+            continue;
+        }
+        let mut sum = 0;
+        for c in counts.iter_mut() {
+            (*c, sum) = (sum, sum + *c);
+        }
+        for &k in keys.iter() {
+            let d = k.byte(shift);
+            tmp[counts[d]] = k;
+            counts[d] += 1;
+        }
+        std::mem::swap(keys, &mut tmp);
+    }
+}
+
+/// Sorted frontier without repeats. Chunks are split on the top byte of the
+/// layout in parallel, then every bucket is gathered, radix sorted on the
+/// bits below and deduplicated on its own.
+fn sort_dedup<K: Packed>(states: Vec<K>, bits: u32) -> Vec<K> {
+    let shift = bits.saturating_sub(8);
+    let chunk = states
+        .len()
+        .div_ceil(rayon::current_num_threads())
+        .max(1 << 12);
+    let parts: Vec<Vec<Vec<K>>> = states
+        .par_chunks(chunk)
+        .map(|c| {
+            let mut buckets = vec![Vec::new(); 256];
+            for &k in c {
+                buckets[k.byte(shift)].push(k);
+            }
+            buckets
+        })
+        .collect();
+    drop(states);
+
+    (0..256)
+        .into_par_iter()
+        .flat_map_iter(|d| {
+            let mut bucket = Vec::with_capacity(parts.iter().map(|p| p[d].len()).sum());
+            for p in &parts {
+                bucket.extend_from_slice(&p[d]);
+            }
+            radix_sort(&mut bucket, shift);
+            bucket.dedup();
+            bucket
+        })
+        .collect()
 }
 
-fn solve_min_press(task: Task) -> u64 {
+/// Union of two sorted sets with nothing in common. b is cut into slices,
+/// each merged in parallel with the part of a that falls between its ends.
+fn merge_sorted<K: Packed>(a: &[K], b: &[K]) -> Vec<K> {
+    if b.is_empty() {
+        return a.to_vec();
+    }
+    let chunk = b.len().div_ceil(rayon::current_num_threads() * 4);
+    let cut = |i: usize| match b.get(i * chunk) {
+        Some(k) => a.partition_point(|x| x < k),
+        None => a.len(),
+    };
+    (0..b.len().div_ceil(chunk))
+        .into_par_iter()
+        .flat_map_iter(|i| {
+            let b = &b[i * chunk..b.len().min((i + 1) * chunk)];
+            let a = &a[if i == 0 { 0 } else { cut(i) }..cut(i + 1)];
+            itertools::merge(a.iter().copied(), b.iter().copied())
+        })
+        .collect()
+}
+
+/// Breadth-first search over press counts, the reference for
+/// `solve_min_press`. States are packed into a u64 or a u128, whichever
+/// holds the layout, and every level is deduplicated by sorting.
+fn solve_bfs(task: Task) -> u64 {
     debug_println!("target = {:?} buttons = {:?}", &task.target, &task.buttons);
     if task.target == VEC10_EMPTY {
         return 0;
     }
 
-    let mut state = task.buttons.clone();
-    let mut seen: AHashSet<Vec10> = state.iter().copied().collect();
+    let layout = Layout::new(&task.target);
+    match layout.bits {
+        0..=64 => bfs::<u64>(&task, &layout),
+        65..=128 => bfs::<u128>(&task, &layout),
+        _ => bfs_wide(&task),
+    }
+}
+
+/// `s` plus `b` when no counter goes past its target
+fn press(s: &[u16; 10], b: &[u16; 10], target: &[u16; 10]) -> Option<[u16; 10]> {
+    let mut next = *s;
+    for i in 0..10 {
+        next[i] = s[i].checked_add(b[i]).filter(|&v| v <= target[i])?;
+    }
+    Some(next)
+}
+
+/// The same frontier search on plain counter arrays, for targets whose
+/// fields need more than 128 bits. Frontiers are deduplicated with a
+/// comparison sort instead of the radix sort on packed keys.
+fn bfs_wide(task: &Task) -> u64 {
+    let target = task.target.0;
+    let buttons: Vec<[u16; 10]> = task.buttons.iter().map(|b| b.0).collect();
+
+    let mut state: Vec<[u16; 10]> = buttons
+        .iter()
+        .filter_map(|b| press(&[0; 10], b, &target))
+        .collect();
+    state.sort_unstable();
+    state.dedup();
+    let mut seen = state.clone();
+    let mut step = 1u64;
+    while !state.is_empty() {
+        if state.binary_search(&target).is_ok() {
+            println!("{:?} solution {}", task.target, step);
+            return step;
+        }
+        step += 1;
+        let mut next: Vec<[u16; 10]> = state
+            .par_iter()
+            .flat_map_iter(|s| buttons.iter().filter_map(move |b| press(s, b, &target)))
+            .collect();
+        next.sort_unstable();
+        next.dedup();
+        next.retain(|s| seen.binary_search(s).is_err());
+        seen.extend_from_slice(&next);
+        seen.sort_unstable();
+        state = next;
+    }
+    unreachable!()
+}
+
+fn bfs<K: Packed>(task: &Task, layout: &Layout) -> u64 {
+    let target: K = layout.pack(&task.target);
+    let guards: K = layout.guards();
+    let limit = target | guards;
+    let fits = |s: K| (limit - s) & guards == guards;
+    // Counters without a target have no field, their buttons never fit
+    let buttons: Vec<K> = task
+        .buttons
+        .iter()
+        .filter(|b| {
+            b.iter()
+                .zip(task.target.iter())
+                .all(|(&b, &t)| b == 0 || t != 0)
+        })
+        .map(|b| layout.pack(b))
+        .collect();
+
+    let mut state = sort_dedup(buttons.clone(), layout.bits);
+    let mut seen = state.clone();
     let mut step = 1u64;
     while !state.is_empty() {
         perf!(&format!("#{step:<5} search({})", state.len()), {
-            if seen.contains(&task.target) {
+            if state.binary_search(&target).is_ok() {
                 println!("{:?} solution {}", task.target, step);
                 return step;
             }
@@ -213,14 +637,18 @@ fn solve_min_press(task: Task) -> u64 {
         state = perf!(&format!("       expand({})", state.len()), {
             state
                 .into_par_iter()
-                .flat_map_iter(|it| task.buttons.iter().map(move |btn| *btn + it))
-                .filter(|it| *it <= task.target)
+                .flat_map_iter(|s| buttons.iter().map(move |&b| s + b))
+                .filter(|&s| fits(s))
                 .collect()
         });
 
         state = perf!(&format!("       reduce({})", state.len()), {
-            seen.reserve(state.len());
-            state.into_iter().filter(|v| seen.insert(*v)).collect()
+            let state: Vec<K> = sort_dedup(state, layout.bits)
+                .into_par_iter()
+                .filter(|s| seen.binary_search(s).is_err())
+                .collect();
+            seen = merge_sorted(&seen, &state);
+            state
         });
     }
     unreachable!()
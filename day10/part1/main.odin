@@ -1,5 +1,6 @@
 package main
 
+import "base:intrinsics"
 import "core:bytes"
 import "core:fmt"
 import vmem "core:mem/virtual"
@@ -68,40 +69,54 @@ main :: proc() {
 	fmt.println("acc =", acc)
 }
 
+// Lights only see presses mod 2, so a solution is a set of buttons whose
+// masks xor to target: x over GF(2) with A x = target. Row reducing the
+// button masks while tracking which buttons make up each row gives one
+// solution and a basis of the press sets that toggle nothing. Every solution
+// is that one xor a combination of the basis, and the combinations are
+// walked in Gray code order, so each step is a single xor.
 solve_min_press :: proc(target: uint, buttons: [dynamic]uint) -> int {
 	dprintfln("target = %v(%#b) buttons = %v", target, target, buttons)
 	if target == 0 do return 0
 
-	state := make([dynamic]uint)
-	seen := make(map[uint]struct{})
-	seen[0] = {}
-	for s in buttons {
-		if s == target do return 1
-		seen[s] = {}
-		append(&state, s)
+	Row :: struct {
+		lights:  uint,
+		presses: uint,
 	}
-
-	new_state := make([dynamic]uint)
-	step := 1
-	for {
-		clear(&new_state)
-		step += 1
-		dprintln("step =", step, state)
-		assert(len(state) > 0)
-		for s in state {
-			for btn in buttons {
-				new_s := s ~ btn
-				dprintfln("%#8b = %#8b~%#8b", new_s, s, btn)
-				if new_s == target do return step
-				if new_s in seen do continue
-				seen[new_s] = {}
-				append(&new_state, new_s)
+	high_bit :: proc(x: uint) -> uint {
+		return size_of(uint) * 8 - 1 - intrinsics.count_leading_zeros(x)
+	}
+	// basis[b] has b as its highest light
+	basis: [size_of(uint) * 8]Row
+	nullspace := make([dynamic]uint)
+	for btn, i in buttons {
+		row := Row{btn, 1 << uint(i)}
+		for row.lights != 0 {
+			b := high_bit(row.lights)
+			if basis[b].lights == 0 {
+				basis[b] = row
+				break
 			}
+			row.lights ~= basis[b].lights
+			row.presses ~= basis[b].presses
 		}
-		clear(&state)
-		for s in new_state {
-			append(&state, s)
-		}
+		if row.lights == 0 do append(&nullspace, row.presses)
+	}
+	dprintln("nullspace =", nullspace)
+
+	x := Row{target, 0}
+	for x.lights != 0 {
+		b := high_bit(x.lights)
+		if basis[b].lights == 0 do return -1
+		x.lights ~= basis[b].lights
+		x.presses ~= basis[b].presses
+	}
+
+	presses := x.presses
+	best := int(intrinsics.count_ones(presses))
+	for i in uint(1) ..< (uint(1) << uint(len(nullspace))) {
+		presses ~= nullspace[intrinsics.count_trailing_zeros(i)]
+		best = min(best, int(intrinsics.count_ones(presses)))
 	}
-	return -1
+	return best
 }
@@ -37,7 +37,7 @@ int any_parts_repeating(uint64_t n) {
 // NOTE: There was a bug, that could be caught with -Wall -Wextra -Wconversion
 // -Wsign-conversion
 uint64_t sum_patterns(uint64_t from, uint64_t to) {
-  log("%ld..=%ld\n", from, to);
+  log_trace("%ld..=%ld\n", from, to);
   uint64_t sum = 0;
   for (uint64_t i = from; i <= to; i++) {
     if (any_parts_repeating(i)) {
@@ -3,106 +3,607 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../utils/bitgrid.h"
 #include "../utils/da.h"
 #include "../utils/file.h"
 #include "../utils/log.h"
+#include "../utils/threadpool.h"
+
+#define CELL_EMPTY 0xFF
+#define MAX_NEIGHBORS 3
+#define MIN_TILE_ROWS 32
+
+#define STREAM_DEFAULT_ROWS 1024
 
 typedef struct {
   unsigned char *value;
-  int size;
+  int width;
+  int height;
 } Map;
 
-static inline int index_2d(int stride, int x, int y) { return y * stride + x; }
+/*
+ * Peeling state: live neighbor count of every roll, CELL_EMPTY for empty or
+ * removed cells. The array has a CELL_EMPTY border so the 8 neighbors of any
+ * grid cell are always addressable.
+ */
+typedef struct {
+  uint8_t *deg;
+  int rows;
+  int cols;
+  int stride;
+  int offsets[8];
+} Peel;
 
-static int dfs(Map *m, int x, int y) {
-  const int size = m->size;
-  const int stride = size + 1;
-  unsigned char *restrict grid = m->value;
+static inline uint32_t peel_index(const Peel *p, int x, int y) {
+  return (uint32_t)((y + 1) * p->stride + x + 1);
+}
 
-  const int y_start = (x >= 0 && y > 0) ? y - 1 : 0;
-  const int y_end = (y + 1 < size) ? y + 1 : (size - 1);
-  const int x_start = (x > 0) ? x - 1 : 0;
-  const int x_end = (x + 1 < size) ? x + 1 : (size - 1);
+static int peel_init(Peel *p, int rows, int cols) {
+  p->rows = rows;
+  p->cols = cols;
+  p->stride = cols + 2;
 
-  int neighbor_count = 0;
-  for (int cy = y_start; cy <= y_end; ++cy) {
-    unsigned char *row = grid + cy * stride + x_start;
-    for (int cx = x_start; cx <= x_end; ++cx, ++row) {
-      if (cy == y && cx == x) {
-        continue;
+  size_t total = (size_t)(rows + 2) * (size_t)p->stride;
+  if (total > UINT32_MAX) {
+    return 0;
+  }
+  p->deg = make(uint8_t, total);
+  if (!p->deg) {
+    return 0;
+  }
+  memset(p->deg, CELL_EMPTY, total);
+
+  int i = 0;
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      if (dy || dx) {
+        p->offsets[i++] = dy * p->stride + dx;
       }
-      if (*row == '@') {
-        if (++neighbor_count > 3) {
-          return 0;
+    }
+  }
+  return 1;
+}
+
+/* Byte i of spread_bits[b] is bit i of b */
+static uint64_t spread_bits[256];
+
+static void spread_bits_init(void) {
+  for (int b = 0; b < 256; ++b) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+      v |= (uint64_t)((b >> i) & 1) << (i * 8);
+    }
+    spread_bits[b] = v;
+  }
+}
+
+/*
+ * Fills degrees of rows [y0, y1) from the bit-sliced neighbor counts and
+ * queues every roll that is removable right away. Returns the queued count.
+ */
+static size_t peel_build_rows(Peel *p, const BitGrid *bg, int y0, int y1,
+                              uint32_t **queue) {
+  uint64_t *planes = make(uint64_t, 4 * bg->words);
+  uint64_t *z0 = planes, *z1 = z0 + bg->words, *z2 = z1 + bg->words,
+           *z3 = z2 + bg->words;
+  size_t seeds = 0;
+
+  for (int y = y0; y < y1; ++y) {
+    const uint64_t *cur = bitgrid_row(bg, y);
+    bitgrid_row_counts(bitgrid_row(bg, y - 1), cur, bitgrid_row(bg, y + 1),
+                       bg->words, z0, z1, z2, z3);
+
+    uint8_t *row = p->deg + peel_index(p, 0, y);
+    for (int x = 0; x < p->cols; x += 8) {
+      int w = x / 64, shift = x % 64;
+      unsigned live = (unsigned)(cur[w] >> shift) & 0xFF;
+      uint64_t deg = spread_bits[(z0[w] >> shift) & 0xFF] |
+                     spread_bits[(z1[w] >> shift) & 0xFF] << 1 |
+                     spread_bits[(z2[w] >> shift) & 0xFF] << 2 |
+                     spread_bits[(z3[w] >> shift) & 0xFF] << 3;
+      deg |= spread_bits[~live & 0xFF] * CELL_EMPTY;
+
+      int n = p->cols - x < 8 ? p->cols - x : 8;
+      memcpy(row + x, &deg, (size_t)n);
+      for (int i = 0; i < n; ++i) {
+        if (row[x + i] <= MAX_NEIGHBORS) {
+          append(*queue, peel_index(p, x + i, y));
+          seeds++;
         }
       }
     }
   }
 
-  grid[index_2d(stride, x, y)] = 'x';
+  da_free(planes);
+  return seeds;
+}
+
+/*
+ * A horizontal band of rows [y0, y1) owned by one worker. Its first and last
+ * rows are the halo shared with the neighboring tiles: removals there are
+ * recorded instead of decrementing cells the neighbor owns.
+ */
+typedef struct Tile {
+  Peel *p;
+  const BitGrid *bg;
+  int y0;
+  int y1;
+  uint32_t *queue;
+  uint32_t *halo_top;
+  uint32_t *halo_bottom;
+  struct Tile *above;
+  struct Tile *below;
+  size_t removable;
+  size_t removed;
+} Tile;
+
+static inline void peel_decrement(uint8_t *deg, uint32_t j, uint32_t **queue) {
+  if (deg[j] != CELL_EMPTY && deg[j]-- == MAX_NEIGHBORS + 1) {
+    append(*queue, j);
+  }
+}
+
+static void tile_build(void *arg) {
+  Tile *t = (Tile *)arg;
+  t->removable = peel_build_rows(t->p, t->bg, t->y0, t->y1, &t->queue);
+}
+
+/*
+ * k-core style peeling: removes queued rolls, decrements their neighbors and
+ * queues every neighbor that drops to MAX_NEIGHBORS. Each roll is queued at
+ * most once, so the work is linear in the number of cells.
+ */
+static void tile_run(void *arg) {
+  Tile *t = (Tile *)arg;
+  Peel *p = t->p;
+  uint8_t *restrict deg = p->deg;
+  const uint32_t top_end = peel_index(p, -1, t->y0 + 1);
+  const uint32_t bottom_start = peel_index(p, -1, t->y1 - 1);
+
+  da_clear(t->halo_top);
+  da_clear(t->halo_bottom);
+
+  for (size_t head = 0; head < da_len(t->queue); ++head) {
+    uint32_t i = t->queue[head];
+    deg[i] = CELL_EMPTY;
+    t->removed++;
+
+    // offsets are ordered by row: [0, 3) above, [3, 5) same row, [5, 8) below
+    int k0 = 0, k1 = 8;
+    if (t->above && i < top_end) {
+      append(t->halo_top, i);
+      k0 = 3;
+    }
+    if (t->below && i >= bottom_start) {
+      append(t->halo_bottom, i);
+      k1 = 5;
+    }
+    for (int k = k0; k < k1; ++k) {
+      peel_decrement(deg, (uint32_t)((int64_t)i + p->offsets[k]), &t->queue);
+    }
+  }
+  da_clear(t->queue);
+}
 
-  int result = 1;
-  for (int cy = y_start; cy <= y_end; ++cy) {
-    unsigned char *row = grid + cy * stride + x_start;
-    for (int cx = x_start; cx <= x_end; ++cx, ++row) {
-      if (*row == '@') {
-        result += dfs(m, cx, cy);
+/* Applies the neighbors' halo removals to this tile's edge rows */
+static void tile_exchange(void *arg) {
+  Tile *t = (Tile *)arg;
+  Peel *p = t->p;
+  if (t->above) {
+    foreach (i, t->above->halo_bottom) {
+      for (int k = 5; k < 8; ++k) {
+        peel_decrement(p->deg, (uint32_t)((int64_t)*i + p->offsets[k]),
+                       &t->queue);
+      }
+    }
+  }
+  if (t->below) {
+    foreach (i, t->below->halo_top) {
+      for (int k = 0; k < 3; ++k) {
+        peel_decrement(p->deg, (uint32_t)((int64_t)*i + p->offsets[k]),
+                       &t->queue);
       }
     }
   }
+}
 
-  return result;
+static void tiles_submit(threadpool_t *pool, Tile *tiles, tp_task_fn fn) {
+  foreach (t, tiles) {
+    threadpool_submit(pool, fn, t);
+  }
+  threadpool_wait(pool);
 }
 
-int main(int argc, char **argv) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <file_input>\n", argv[0]);
-    return 1;
+/* Measures the grid, every row must be as wide as the first one */
+static int map_measure(Map *m, unsigned char *data) {
+  const unsigned char *p = data;
+  const unsigned char *end = data + da_len(data);
+  m->value = data;
+  m->width = -1;
+  m->height = 0;
+
+  while (p < end) {
+    const unsigned char *nl = memchr(p, '\n', (size_t)(end - p));
+    const unsigned char *eol = nl ? nl : end;
+    if (memchr(p, '\r', (size_t)(eol - p))) {
+      fprintf(stderr, "Remove CR from data\n");
+      return 0;
+    }
+    int len = (int)(eol - p);
+    if (m->width < 0) {
+      m->width = len;
+    } else if (len != m->width) {
+      fprintf(stderr, "Row %d has %d cells, expected %d\n", m->height + 1, len,
+              m->width);
+      return 0;
+    }
+    m->height += 1;
+    p = eol + 1;
+  }
+
+  if (m->width <= 0) {
+    fprintf(stderr, "Empty grid\n");
+    return 0;
   }
+  return 1;
+}
 
+static int solve_in_memory(const char *path, size_t *removable,
+                           size_t *counter) {
   unsigned char *data = NULL;
-  if (!read_entire_file(argv[1], &data)) {
+  if (!read_entire_file(path, &data)) {
     fprintf(stderr, "Error opening file\n");
-    return 1;
+    return 0;
   }
 
   Map m;
-  m.value = data;
-  m.size = 0;
+  if (!map_measure(&m, data)) {
+    da_free(data);
+    return 0;
+  }
+  log("m.width = %d m.height = %d\n", m.width, m.height);
+
+  const int stride = m.width + 1;
+
+  BitGrid bg;
+  Peel p;
+  if (!bitgrid_init(&bg, (size_t)m.height, (size_t)m.width) ||
+      !peel_init(&p, m.height, m.width)) {
+    fprintf(stderr, "Out of memory\n");
+    da_free(data);
+    return 0;
+  }
+  bitgrid_from_chars(&bg, m.value, (size_t)stride, '@');
+  spread_bits_init();
+
+  threadpool_t pool;
+  if (threadpool_init(&pool, 0) != 0) {
+    fprintf(stderr, "Failed to initialize thread pool\n");
+    da_free(data);
+    return 0;
+  }
+
+  int ntiles = m.height / MIN_TILE_ROWS;
+  if (ntiles > pool.nthreads)
+    ntiles = pool.nthreads;
+  if (ntiles < 1)
+    ntiles = 1;
+  log("ntiles = %d\n", ntiles);
+
+  Tile *tiles = make(Tile, (size_t)ntiles);
+  for (int i = 0; i < ntiles; ++i) {
+    Tile t = {0};
+    t.p = &p;
+    t.bg = &bg;
+    t.y0 = (int)((int64_t)m.height * i / ntiles);
+    t.y1 = (int)((int64_t)m.height * (i + 1) / ntiles);
+    t.queue = make(uint32_t, (size_t)(t.y1 - t.y0) * (size_t)m.width / 2 + 1);
+    append(tiles, t);
+  }
+  for (int i = 0; i < ntiles; ++i) {
+    tiles[i].above = i > 0 ? &tiles[i - 1] : NULL;
+    tiles[i].below = i + 1 < ntiles ? &tiles[i + 1] : NULL;
+  }
+
+  tiles_submit(&pool, tiles, tile_build);
+  bitgrid_free(&bg);
+
+  // Peel every tile independently, then trade edge removals until no tile
+  // has anything left to hand over. Peeling is order independent, so this
+  // reaches the same fixed point as the serial solve.
+  for (int round = 1;; ++round) {
+    tiles_submit(&pool, tiles, tile_run);
+    size_t exchanged = 0;
+    foreach (t, tiles) {
+      exchanged += da_len(t->halo_top) + da_len(t->halo_bottom);
+    }
+    log("round %d exchanged = %zu\n", round, exchanged);
+    if (exchanged == 0)
+      break;
+    tiles_submit(&pool, tiles, tile_exchange);
+  }
+  threadpool_destroy(&pool);
+
+  *removable = 0;
+  *counter = 0;
+  foreach (t, tiles) {
+    *removable += t->removable;
+    *counter += t->removed;
+    da_free(t->queue);
+    da_free(t->halo_top);
+    da_free(t->halo_bottom);
+  }
+  da_free(tiles);
+
+#if LOGGER_ENABLED
+  for (int y = 0; y < m.height; ++y) {
+    for (int x = 0; x < m.width; ++x) {
+      unsigned char *c = m.value + y * stride + x;
+      if (*c == '@' && p.deg[peel_index(&p, x, y)] == CELL_EMPTY) {
+        *c = 'x';
+      }
+    }
+  }
+  logger_flush();
+  fwrite(m.value, 1, da_len(data), stdout);
+  putchar('\n');
+#endif
+
+  da_free(p.deg);
+  da_free(data);
+  return 1;
+}
+
+/*
+ * Streaming solver: only a window of rows is resident, as a ring of degree
+ * rows. A row gets its degrees once the row below it is read and leaves the
+ * window as text for the next pass. Removals that would have to reach a row
+ * already written out are picked up by the next pass, passes repeat until one
+ * removes nothing. Memory stays at window * width bytes whatever the height.
+ */
+typedef struct {
+  FILE *in;
+  FILE *out;
+  int width;
+  int window;
+  uint8_t *deg;              /* window rows of width + 2 */
+  unsigned char *line;       /* width + 1, read buffer */
+  unsigned char *out_line;   /* width + 1, write buffer */
+  unsigned char *orig;       /* last 3 input rows, first pass only */
+  uint64_t *queue;           /* row << 32 | x */
+  int64_t first;             /* oldest resident row */
+  int64_t next;              /* next row to read */
+  int64_t computed;          /* rows below this have no degrees yet */
+  size_t removable;
+  size_t removed;
+} Stream;
+
+static inline uint8_t *stream_row(const Stream *s, int64_t y) {
+  return s->deg + (size_t)(y % s->window) * (size_t)(s->width + 2) + 1;
+}
+
+static void stream_decrement(Stream *s, int64_t y, int x) {
+  if (y < s->first || y >= s->computed)
+    return;
+  uint8_t *d = stream_row(s, y) + x;
+  if (*d != CELL_EMPTY && (*d)-- == MAX_NEIGHBORS + 1) {
+    append(s->queue, (uint64_t)y << 32 | (uint32_t)x);
+  }
+}
+
+static void stream_peel(Stream *s) {
+  while (da_len(s->queue) > 0) {
+    uint64_t item = da_pop(s->queue);
+    int64_t y = (int64_t)(item >> 32);
+    int x = (int)(uint32_t)item;
+    stream_row(s, y)[x] = CELL_EMPTY;
+    s->removed++;
+    for (int64_t cy = y - 1; cy <= y + 1; ++cy) {
+      for (int cx = x - 1; cx <= x + 1; ++cx) {
+        if (cy != y || cx != x) {
+          stream_decrement(s, cy, cx);
+        }
+      }
+    }
+  }
+}
+
+/* Computes degrees of row `computed`, all its neighbor rows are resident */
+static void stream_compute(Stream *s, int has_below) {
+  int64_t y = s->computed;
+  uint8_t *rows[3] = {y > 0 ? stream_row(s, y - 1) : NULL, stream_row(s, y),
+                      has_below ? stream_row(s, y + 1) : NULL};
+  const unsigned char *orig[3] = {NULL, NULL, NULL};
+  if (s->orig) {
+    int w = s->width + 1;
+    orig[0] = y > 0 ? s->orig + ((y - 1) % 3) * w : NULL;
+    orig[1] = s->orig + (y % 3) * w;
+    orig[2] = has_below ? s->orig + ((y + 1) % 3) * w : NULL;
+  }
+
+  uint8_t *row = rows[1];
+  for (int x = 0; x < s->width; ++x) {
+    if (row[x] == CELL_EMPTY)
+      continue;
+    int n = 0, n_orig = 0;
+    for (int r = 0; r < 3; ++r) {
+      if (!rows[r])
+        continue;
+      for (int dx = -1; dx <= 1; ++dx) {
+        if (r == 1 && dx == 0)
+          continue;
+        n += rows[r][x + dx] != CELL_EMPTY;
+        if (orig[r] && x + dx >= 0 && x + dx < s->width)
+          n_orig += orig[r][x + dx] == '@';
+      }
+    }
+    row[x] = (uint8_t)n;
+    if (s->orig && n_orig <= MAX_NEIGHBORS)
+      s->removable++;
+    if (n <= MAX_NEIGHBORS)
+      append(s->queue, (uint64_t)y << 32 | (uint32_t)x);
+  }
+  s->computed++;
+  stream_peel(s);
+}
+
+static void stream_evict(Stream *s) {
+  const uint8_t *row = stream_row(s, s->first);
+  for (int x = 0; x < s->width; ++x) {
+    s->out_line[x] = row[x] == CELL_EMPTY ? '.' : '@';
+  }
+  s->out_line[s->width] = '\n';
+  fwrite(s->out_line, 1, (size_t)s->width + 1, s->out);
+  s->first++;
+}
+
+/* Reads one row into the window, returns 0 at the end of input, -1 on error */
+static int stream_read(Stream *s) {
+  size_t n = fread(s->line, 1, (size_t)s->width + 1, s->in);
+  if (n == 0)
+    return 0;
+  if (n < (size_t)s->width ||
+      (n == (size_t)s->width + 1 && s->line[s->width] != '\n')) {
+    fprintf(stderr, "Row %lld is not %d cells wide\n", (long long)s->next + 1,
+            s->width);
+    return -1;
+  }
 
-  for (size_t i = 0; i < da_len(data); ++i) {
-    unsigned char c = data[i];
-    if (c == '\r') {
+  if (s->next - s->first == s->window)
+    stream_evict(s);
+  uint8_t *row = stream_row(s, s->next);
+  for (int x = 0; x < s->width; ++x) {
+    if (s->line[x] == '\r') {
       fprintf(stderr, "Remove CR from data\n");
-      da_free(data);
-      return 1;
+      return -1;
+    }
+    row[x] = s->line[x] == '@' ? 0 : CELL_EMPTY;
+  }
+  if (s->orig)
+    memcpy(s->orig + (s->next % 3) * (s->width + 1), s->line, (size_t)s->width);
+  s->next++;
+  return 1;
+}
+
+static int stream_pass(Stream *s) {
+  s->first = s->next = s->computed = 0;
+  s->removed = 0;
+
+  int rc;
+  while ((rc = stream_read(s)) > 0) {
+    if (s->next >= 2)
+      stream_compute(s, 1);
+  }
+  if (rc < 0)
+    return 0;
+  if (s->next > 0)
+    stream_compute(s, 0);
+  while (s->first < s->next)
+    stream_evict(s);
+  return 1;
+}
+
+static int solve_streaming(const char *path, int window, size_t *removable,
+                           size_t *counter) {
+  Stream s = {0};
+  s.window = window;
+  s.in = fopen(path, "rb");
+  if (!s.in) {
+    fprintf(stderr, "Error opening file\n");
+    return 0;
+  }
+
+  int c;
+  while ((c = fgetc(s.in)) != EOF && c != '\n')
+    s.width++;
+  if (s.width == 0) {
+    fprintf(stderr, "Empty grid\n");
+    fclose(s.in);
+    return 0;
+  }
+  rewind(s.in);
+
+  s.deg = make(uint8_t, (size_t)window * (size_t)(s.width + 2));
+  s.line = make(unsigned char, (size_t)s.width + 1);
+  s.out_line = make(unsigned char, (size_t)s.width + 1);
+  s.orig = make(unsigned char, 3 * ((size_t)s.width + 1));
+  s.queue = make(uint64_t, (size_t)s.width);
+  if (!s.deg || !s.line || !s.out_line || !s.orig || !s.queue) {
+    fprintf(stderr, "Out of memory\n");
+    fclose(s.in);
+    return 0;
+  }
+  memset(s.deg, CELL_EMPTY, (size_t)window * (size_t)(s.width + 2));
+  log("width = %d window = %d\n", s.width, window);
+
+  int ok = 1;
+  *counter = 0;
+  for (int pass = 1;; ++pass) {
+    s.out = tmpfile();
+    if (!s.out) {
+      perror("Error creating temporary file");
+      ok = 0;
+      break;
     }
-    if (c == '\n') {
+    if (!stream_pass(&s)) {
+      fclose(s.out);
+      ok = 0;
       break;
     }
-    m.size += 1;
+    if (pass == 1) {
+      *removable = s.removable;
+      da_free(s.orig);
+      s.orig = NULL;
+    }
+    *counter += s.removed;
+    log("pass %d removed = %zu\n", pass, s.removed);
+
+    fclose(s.in);
+    s.in = s.out;
+    rewind(s.in);
+    if (s.removed == 0)
+      break;
   }
 
-  log("m.size = %d\n", m.size);
+  fclose(s.in);
+  da_free(s.deg);
+  da_free(s.line);
+  da_free(s.out_line);
+  da_free(s.orig);
+  da_free(s.queue);
+  return ok;
+}
 
-  const int stride = m.size + 1;
-  int counter = 0;
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <file_input> [--stream[=rows]]\n", argv[0]);
+    return 1;
+  }
 
-  for (int y = 0; y < m.size; ++y) {
-    unsigned char *row = m.value + y * stride;
-    for (int x = 0; x < m.size; ++x) {
-      if (row[x] == '@') {
-        counter += dfs(&m, x, y);
+  int window = 0;
+  if (argc > 2) {
+    if (strcmp(argv[2], "--stream") == 0) {
+      window = STREAM_DEFAULT_ROWS;
+    } else if (strncmp(argv[2], "--stream=", 9) == 0) {
+      window = atoi(argv[2] + 9);
+      if (window < 3) {
+        fprintf(stderr, "Streaming window must hold at least 3 rows\n");
+        return 1;
       }
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[2]);
+      return 1;
     }
   }
 
-#if LOGGER_ENABLED
-  fwrite(m.value, 1, data_size, stdout);
-  putchar('\n');
-#endif
+  size_t removable = 0;
+  size_t counter = 0;
+  int ok = window ? solve_streaming(argv[1], window, &removable, &counter)
+                  : solve_in_memory(argv[1], &removable, &counter);
+  if (!ok)
+    return 1;
 
-  print_value(counter, "%d");
-  da_free(data);
+  log_value(removable, "%zu");
+  print_value(counter, "%zu");
   return 0;
 }
@@ -1,18 +1,38 @@
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../utils/da.h"
+#include "../utils/eytzinger.h"
 #include "../utils/file.h"
+#include "../utils/intervals.h"
 #include "../utils/numbers.h"
 #include "../utils/perf_measure.h"
+#include "../utils/threadpool.h"
+
+// IDs parsed per batch
+#define QUERY_BLOCK (1u << 22)
+// IDs per threadpool task
+#define QUERY_CHUNK (1u << 16)
+// Sort and sweep once a chunk has at least 1 ID per this many ranges
+#define SWEEP_RATIO 4
 
 typedef struct {
   uint64_t left;
   uint64_t right;
 } RangeInclusive;
 
+// Merged ranges plus their search layout, either built in memory or mapped
+// from an index file
+typedef struct {
+  const RangeInclusive *ranges;
+  size_t len;
+  Eytzinger index;
+} RangeSet;
+
 int range_compare(const void *a, const void *b) {
   const RangeInclusive *ra = a;
   const RangeInclusive *rb = b;
@@ -37,37 +57,358 @@ void range_merge_left(RangeInclusive *a, const RangeInclusive *b) {
 
 void merge_ranges(RangeInclusive *ranges) {
   size_t n = da_len(ranges);
+  if (n == 0)
+    return;
   qsort(ranges, n, sizeof(*ranges), range_compare);
 
-  for (size_t i = 0; i + 1 < da_len(ranges); ++i) {
-    if (range_overlap(&ranges[i], &ranges[i + 1])) {
-      range_merge_left(&ranges[i], &ranges[i + 1]);
-      remove_at(ranges, i + 1);
-      i--;
+  // Compact in place, remove_at per merge is quadratic on large inputs
+  size_t last = 0;
+  for (size_t i = 1; i < n; ++i) {
+    if (range_overlap(&ranges[last], &ranges[i])) {
+      range_merge_left(&ranges[last], &ranges[i]);
+    } else {
+      ranges[++last] = ranges[i];
     }
   }
+  da_set_len(ranges, last + 1);
 }
-int is_in_ranges(const RangeInclusive *ranges, const uint64_t number) {
-  size_t len = da_len(ranges);
-  size_t left = 0;
-  size_t right = len;
-  while (left < right) {
-    const size_t mid = left + (right - left) / 2;
-    const RangeInclusive *r = &ranges[mid];
-    if (number < r->left) {
-      right = mid;
-    } else if (number > r->right) {
-      left = mid + 1;
-    } else {
-      return 1;
+
+// Search layout over the merged ranges: left endpoints are the keys, right
+// endpoints the values
+int build_range_set(RangeSet *set, const RangeInclusive *ranges) {
+  set->ranges = ranges;
+  set->len = da_len(ranges);
+  return eytzinger_build(&set->index, &ranges[0].left, 2, &ranges[0].right, 2,
+                         set->len);
+}
+
+int is_in_ranges(const Eytzinger *index, const uint64_t number) {
+  size_t k = eytzinger_find_le(index, number);
+  return k != 0 && number <= index->vals[k];
+}
+
+// Interleaved branchless searches, misses of a whole lane group overlap
+size_t count_by_search(const Eytzinger *index, const uint64_t *ids, size_t n,
+                       size_t *nodes) {
+  eytzinger_find_le_batch(index, ids, n, nodes);
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    size_t k = nodes[i];
+    count += k != 0 && ids[i] <= index->vals[k];
+  }
+  return count;
+}
+
+// Sorts the IDs, then walks them and the sorted ranges together
+size_t count_by_sweep(const RangeInclusive *ranges, size_t len, uint64_t *ids,
+                      size_t n, uint64_t *tmp) {
+  radix_sort_u64(ids, tmp, n);
+  size_t count = 0;
+  size_t j = 0;
+  for (size_t i = 0; i < n; ++i) {
+    while (j < len && ranges[j].right < ids[i])
+      j++;
+    if (j == len)
+      break;
+    count += ranges[j].left <= ids[i];
+  }
+  return count;
+}
+
+typedef struct {
+  const RangeSet *set;
+  uint64_t *ids;
+  size_t n;
+  _Atomic uint64_t *counter;
+} query_job_t;
+
+static void query_job(void *arg) {
+  query_job_t *job = (query_job_t *)arg;
+  // nodes for searching or scratch for sorting, both one word per ID
+  uint64_t *scratch = make(uint64_t, job->n);
+  size_t count;
+  if (job->n * SWEEP_RATIO >= job->set->len) {
+    count = count_by_sweep(job->set->ranges, job->set->len, job->ids, job->n,
+                           scratch);
+  } else {
+    count =
+        count_by_search(&job->set->index, job->ids, job->n, (size_t *)scratch);
+  }
+  da_free(scratch);
+  atomic_fetch_add_explicit(job->counter, count, memory_order_relaxed);
+}
+
+// Counts IDs of a block that fall into any range. Reorders ids.
+uint64_t count_in_ranges(threadpool_t *pool, const RangeSet *set, uint64_t *ids,
+                         size_t n) {
+  _Atomic uint64_t counter = 0;
+  size_t njobs = (n + QUERY_CHUNK - 1) / QUERY_CHUNK;
+  query_job_t *jobs = make(query_job_t, njobs);
+  for (size_t i = 0; i < njobs; ++i) {
+    query_job_t job = {set, ids + i * QUERY_CHUNK, QUERY_CHUNK, &counter};
+    if (i + 1 == njobs)
+      job.n = n - i * QUERY_CHUNK;
+    append(jobs, job);
+  }
+  foreach (job, jobs) {
+    threadpool_submit(pool, query_job, job);
+  }
+  threadpool_wait(pool);
+  da_free(jobs);
+  return atomic_load_explicit(&counter, memory_order_relaxed);
+}
+
+/*
+ * Range index file: the merged ranges and their Eytzinger layout, written
+ * once and mapped by later runs. Sections are cache line aligned so the
+ * mapped search arrays can be used in place.
+ *
+ * The header records the length and hash of the range section it was built
+ * from, hashing those bytes is far cheaper than parsing and merging them.
+ * The payload hash is only checked with --verify, so a normal open touches
+ * just the pages the queries reach. A stale or damaged file is rebuilt.
+ */
+#define INDEX_MAGIC "D5RIDX\0\0"
+#define INDEX_VERSION 3
+#define INDEX_ALIGN 64
+
+// What the index has to match, see source_id
+typedef struct {
+  uint64_t len;  // of the range section
+  uint64_t hash; // of its bytes
+} SourceId;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t file_size;
+  SourceId source;
+  uint64_t nranges;
+  uint64_t ranges_off;
+  uint64_t keys_off;
+  uint64_t vals_off;
+  uint64_t payload_hash;
+  uint64_t header_hash; // of every field above
+} IndexHeader;
+
+uint64_t hash_bytes(const unsigned char *p, size_t len) {
+  uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 31;
+  }
+  for (; i < len; ++i) {
+    h = (h ^ p[i]) * 0x94D049BB133111EBull;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+SourceId source_id(const unsigned char *source, size_t len) {
+  return (SourceId){len, hash_bytes(source, len)};
+}
+
+// Checksum of the ranges and both search arrays
+static uint64_t index_payload_hash(const unsigned char *ranges,
+                                   const unsigned char *keys,
+                                   const unsigned char *vals, size_t n) {
+  uint64_t h = hash_bytes(ranges, n * sizeof(RangeInclusive));
+  h ^= hash_bytes(keys, (n + 1) * sizeof(uint64_t)) * 3;
+  h ^= hash_bytes(vals, (n + 1) * sizeof(uint64_t)) * 5;
+  return h;
+}
+
+static inline uint64_t index_align(uint64_t off) {
+  return (off + INDEX_ALIGN - 1) / INDEX_ALIGN * INDEX_ALIGN;
+}
+
+static void index_layout(IndexHeader *h, uint64_t nranges) {
+  h->header_size = sizeof(*h);
+  h->nranges = nranges;
+  h->ranges_off = index_align(sizeof(*h));
+  h->keys_off = index_align(h->ranges_off + nranges * sizeof(RangeInclusive));
+  h->vals_off = index_align(h->keys_off + (nranges + 1) * sizeof(uint64_t));
+  h->file_size = h->vals_off + (nranges + 1) * sizeof(uint64_t);
+}
+
+static int index_write_at(FILE *f, uint64_t off, const void *p, size_t len) {
+  static const unsigned char zeros[INDEX_ALIGN];
+  long pos = ftell(f);
+  if (pos < 0 || (uint64_t)pos > off || off - (uint64_t)pos > INDEX_ALIGN)
+    return 0;
+  size_t pad = (size_t)(off - (uint64_t)pos);
+  return fwrite(zeros, 1, pad, f) == pad && fwrite(p, 1, len, f) == len;
+}
+
+// Written to a temporary name and renamed, readers never see a partial file
+int index_write(const char *path, const SourceId *source,
+                const RangeSet *set) {
+  IndexHeader h = {0};
+  memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+  h.version = INDEX_VERSION;
+  h.source = *source;
+  index_layout(&h, set->len);
+
+  size_t n = set->len;
+  h.payload_hash = index_payload_hash((const unsigned char *)set->ranges,
+                                      (const unsigned char *)set->index.keys,
+                                      (const unsigned char *)set->index.vals, n);
+  h.header_hash =
+      hash_bytes((const unsigned char *)&h, offsetof(IndexHeader, header_hash));
+
+  size_t tmp_len = strlen(path) + 5;
+  char *tmp = make(char, tmp_len);
+  if (!tmp)
+    return 0;
+  snprintf(tmp, tmp_len, "%s.tmp", path);
+
+  int ok = 0;
+  FILE *f = fopen(tmp, "wb");
+  if (f) {
+    ok = index_write_at(f, 0, &h, sizeof(h)) &&
+         index_write_at(f, h.ranges_off, set->ranges,
+                        n * sizeof(RangeInclusive)) &&
+         index_write_at(f, h.keys_off, set->index.keys,
+                        (n + 1) * sizeof(uint64_t)) &&
+         index_write_at(f, h.vals_off, set->index.vals,
+                        (n + 1) * sizeof(uint64_t));
+    ok = (fclose(f) == 0) && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+      remove(tmp);
+  }
+  da_free(tmp);
+  return ok;
+}
+
+// Maps the index if it was built from this input, verify also checks the
+// payload against its hash
+int index_open(const char *path, const SourceId *source, int verify,
+               MappedFile *map, RangeSet *set) {
+  if (!map_entire_file(path, map))
+    return 0;
+
+  const IndexHeader *h = (const IndexHeader *)map->data;
+  int ok =
+      map->len >= sizeof(*h) &&
+      memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) == 0 &&
+      h->version == INDEX_VERSION && h->header_size == sizeof(*h) &&
+      h->header_hash == hash_bytes(map->data, offsetof(IndexHeader,
+                                                       header_hash)) &&
+      h->file_size == map->len &&
+      memcmp(&h->source, source, sizeof(*source)) == 0;
+  if (ok) {
+    // Offsets are derived from the count, a tampered layout is rejected
+    IndexHeader expect = *h;
+    index_layout(&expect, h->nranges);
+    ok = memcmp(&expect, h, sizeof(expect)) == 0;
+  }
+  if (ok && verify) {
+    ok = index_payload_hash(map->data + h->ranges_off,
+                            map->data + h->keys_off, map->data + h->vals_off,
+                            (size_t)h->nranges) == h->payload_hash;
+  }
+  if (!ok) {
+    unmap_file(map);
+    return 0;
+  }
+
+  set->ranges = (const RangeInclusive *)(map->data + h->ranges_off);
+  set->len = (size_t)h->nranges;
+  set->index.keys = (uint64_t *)(map->data + h->keys_off);
+  set->index.vals = (uint64_t *)(map->data + h->vals_off);
+  set->index.n = set->len;
+  return 1;
+}
+
+/*
+ * Online mode: lines are handled in arrival order, "a-b" inserts a range and a
+ * plain number is checked against the ranges inserted so far. Nothing is
+ * sorted or merged up front, so ranges and IDs may be interleaved.
+ */
+int solve_online(unsigned char *p, unsigned char *end) {
+  IntervalSet set;
+  if (!intervals_init(&set)) {
+    fprintf(stderr, "Out of memory\n");
+    return 0;
+  }
+  int ok = 1;
+  DeferLoopEnd(intervals_free(&set)) {
+    uint64_t counter = 0;
+    PerfMeasureLoopNamed("online") {
+      while (p < end) {
+        unsigned char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol)
+          eol = end;
+        uint64_t left, right;
+        if (!parse_next_number(&p, eol, &left)) {
+          p = eol + 1;
+          continue;
+        }
+        if (p < eol && *p == '-') {
+          if (!parse_next_number(&p, eol, &right)) {
+            fprintf(stderr, "Unexpected data\n");
+            ok = 0;
+            break;
+          }
+          if (!intervals_insert(&set, left, right)) {
+            fprintf(stderr, "Out of memory\n");
+            ok = 0;
+            break;
+          }
+        } else {
+          counter += (uint64_t)intervals_contains(&set, left);
+        }
+        p = eol + 1;
+      }
+    } // PerfMeasureLoopNamed("online")
+    if (ok) {
+      log("%zu disjoint ranges\n", intervals_count(&set));
+      print_value(counter, "%ld");
+      counter = intervals_covered(&set);
+      print_value(counter, "%ld");
     }
   }
-  return 0;
+  return ok;
+}
+
+// End of the range section: the blank line before the IDs
+static unsigned char *find_blank_line(unsigned char *p, unsigned char *end) {
+  while (p + 1 < end) {
+    unsigned char *nl = memchr(p, '\n', (size_t)(end - p - 1));
+    if (!nl)
+      return NULL;
+    if (nl[1] == '\n')
+      return nl;
+    p = nl + 1;
+  }
+  return NULL;
 }
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <file_input>\n", argv[0]);
+  const char *index_path = NULL;
+  int online = 0;
+  int verify = 0;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+      index_path = argv[++i];
+    } else if (strcmp(argv[i], "--online") == 0) {
+      online = 1;
+    } else if (strcmp(argv[i], "--verify") == 0) {
+      verify = 1;
+    } else {
+      argc = 0;
+    }
+  }
+  if (argc < 2 || (online && index_path) || (verify && !index_path)) {
+    fprintf(stderr,
+            "Usage: %s <file_input> [--index <index_file> [--verify] | "
+            "--online]\n",
+            argv[0]);
     return 1;
   }
 
@@ -84,59 +425,118 @@ int main(int argc, char *argv[]) {
       log("Read bytes %ld\n", da_len(data));
       unsigned char *p = data;
       unsigned char *end = p + da_len(data);
-      RangeInclusive *ranges = make(RangeInclusive, 200);
+      if (online) {
+        if (!solve_online(p, end))
+          return 1;
+        continue; // leaves the DeferLoopEnd, data is still freed
+      }
+      unsigned char *split = find_blank_line(p, end);
+      if (!split) {
+        fprintf(stderr, "Unexpected data\n");
+        return 1;
+      }
+      const size_t source_len = (size_t)(split - data);
+
+      RangeInclusive *ranges = NULL;
+      RangeSet set = {0};
+      MappedFile map = {0};
+      SourceId source = {0};
+      if (index_path) {
+        PerfMeasureLoopNamed("source_id") {
+          source = source_id(data, source_len);
+        }
+      }
       DeferLoopEnd(da_free(ranges)) {
-        PerfMeasureLoopNamed("parsing") {
-          log("Parsing\n");
-          while (1) {
-            if (*(p) == '\n' && *(p + 1) == '\n')
-              break;
-            RangeInclusive range = {0};
-            if (!parse_next_number(&p, end, &range.left)) {
-              fprintf(stderr, "Unexpected data\n");
-              return 1;
+        if (index_path) {
+          PerfMeasureLoopNamed("index_open") {
+            if (index_open(index_path, &source, verify, &map, &set)) {
+              log("Loaded %zu ranges from %s\n", set.len, index_path);
             }
-            if (!parse_next_number(&p, end, &range.right)) {
-              fprintf(stderr, "Unexpected data\n");
+          }
+        }
+
+        if (!map.data) {
+          ranges = make(RangeInclusive, 200);
+          PerfMeasureLoopNamed("parsing") {
+            log("Parsing\n");
+            while (p < split) {
+              RangeInclusive range = {0};
+              if (!parse_next_number(&p, end, &range.left)) {
+                fprintf(stderr, "Unexpected data\n");
+                return 1;
+              }
+              if (!parse_next_number(&p, end, &range.right)) {
+                fprintf(stderr, "Unexpected data\n");
+                return 1;
+              }
+              log_trace("%ld..%ld\n", range.left, range.right);
+              append(ranges, range);
+            }
+          } // PerfMeasureLoopNamed("parsing")
+
+          PerfMeasureLoopNamed("optimizing") {
+            log("Optimizing\n");
+            merge_ranges(ranges);
+            if (!build_range_set(&set, ranges)) {
+              fprintf(stderr, "Out of memory\n");
               return 1;
             }
-            log("%ld..%ld\n", range.left, range.right);
-            append(ranges, range);
           }
-        } // PerfMeasureLoopNamed("parsing")
 
-        PerfMeasureLoopNamed("optimizing") {
-          log("Optimizing\n");
-          merge_ranges(ranges);
+          if (index_path) {
+            PerfMeasureLoopNamed("index_write") {
+              if (!index_write(index_path, &source, &set)) {
+                fprintf(stderr, "Failed to write index %s\n", index_path);
+              }
+            }
+          }
         }
+        p = split;
 
 #if DEBUG
-        foreach (range, ranges) {
-          log("%llu..%llu\n", range->left, range->right);
+        for (size_t i = 0; i < set.len; ++i) {
+          log("%llu..%llu\n", set.ranges[i].left, set.ranges[i].right);
         }
 #endif
         PerfMeasureLoopNamed("fresh_counter") {
+          threadpool_t pool;
+          if (threadpool_init(&pool, 0) != 0) {
+            fprintf(stderr, "Failed to initialize thread pool\n");
+            return 1;
+          }
+          uint64_t *ids = make(uint64_t, QUERY_BLOCK);
           uint64_t counter = 0;
-          while (1) {
-            size_t number = 0;
-            if (!parse_next_number(&p, end, &number)) {
-              break;
+          int more = 1;
+          while (more) {
+            da_clear(ids);
+            uint64_t number = 0;
+            while (da_len(ids) < QUERY_BLOCK &&
+                   (more = parse_next_number(&p, end, &number))) {
+              append(ids, number);
             }
-            int matched = is_in_ranges(ranges, number);
-            counter += (uint64_t)matched;
-            log("%ld (%d)\n", number, matched);
+            uint64_t matched = count_in_ranges(&pool, &set, ids, da_len(ids));
+            counter += matched;
+            log_trace("batch of %zu: %lu fresh\n", da_len(ids), matched);
           }
+          da_free(ids);
+          threadpool_destroy(&pool);
           print_value(counter, "%ld");
         } // PerfMeasureLoopNamed("fresh_counter")
         PerfMeasureLoopNamed("range_counter") {
           uint64_t counter = 0;
-          foreach (range, ranges) {
-            uint64_t len = (range->right - range->left + 1);
+          for (size_t i = 0; i < set.len; ++i) {
+            uint64_t len = (set.ranges[i].right - set.ranges[i].left + 1);
             log_value(len, "%ld");
             counter += len;
           }
           print_value(counter, "%ld");
         } // PerfMeasureLoopNamed("range_counter")
+
+        if (map.data) {
+          unmap_file(&map);
+        } else {
+          eytzinger_free(&set.index);
+        }
       } // DeferLoopEnd(da_free(ranges))
     } // DeferLoopEnd
   } // PerfMeasureLoopNamed("entire")
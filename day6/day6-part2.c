@@ -5,23 +5,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "../utils/csr.h"
 #include "../utils/da.h"
 #include "../utils/file.h"
 #include "../utils/perf_measure.h"
+#include "../utils/transpose.h"
 
-int parse_row_number(unsigned char *p, unsigned char *end,
-                     const size_t row_size, uint64_t *n) {
+// Reads the vertical number of one column, laid out contiguously
+int parse_column_number(const unsigned char *p, const unsigned char *end,
+                        uint64_t *n) {
   while (p < end && !isdigit(*p))
-    p += row_size;
+    p++;
   if (p >= end)
     return 0;
-  unsigned char *q = p;
-  while (q < end && isdigit(*q)) {
-    q += row_size;
-  }
   *n = 0;
-  for (unsigned char *r = p; r < q; r += row_size)
-    *n = *n * 10 + (*r - '0');
+  for (; p < end && isdigit(*p); p++)
+    *n = *n * 10 + (*p - '0');
   return 1;
 }
 
@@ -53,40 +52,50 @@ int main(int argc, char *argv[]) {
         row_size = (size_t)(q - p) + 1;
       }
 
-      uint64_t **numbers = make(uint64_t *, row_size);
+      unsigned char *ops = p;
+      while (ops < end && (*ops != '*' && *ops != '+'))
+        ops++;
+      const size_t rows = (size_t)(ops - data) / row_size;
+      const size_t cols = row_size - 1;
+
+      // Column-major copy of the digit rows, every column is one run of
+      // `rows` bytes instead of one byte per cache line
+      unsigned char *columns = make(unsigned char, cols * rows);
+      PerfMeasureLoopNamed("transpose") {
+        transpose_bytes(columns, rows, data, row_size, rows, cols);
+      }
+
+      // A blank column closes the current problem
+      Csr numbers;
+      if (!csr_init(&numbers, cols)) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+      }
       PerfMeasureLoopNamed("parse") {
-        size_t i = 0;
-        while (p < end && *p != '\n') {
+        for (size_t c = 0; c < cols; ++c) {
+          const unsigned char *col = columns + c * rows;
           uint64_t num = 0;
-          if (!parse_row_number(p, end, row_size, &num)) {
-            i++;
-            p++;
+          if (!parse_column_number(col, col + rows, &num)) {
+            csr_end_row(&numbers);
             continue;
           }
-          if (i >= da_len(numbers)) {
-            append(numbers, make(uint64_t, 10));
-          }
-          append(numbers[i], num);
-          p++;
+          csr_push(&numbers, num);
         }
+        // The last problem has no blank column after it
+        if (csr_len(&numbers) > numbers.offsets[csr_rows(&numbers)])
+          csr_end_row(&numbers);
       }
+      da_free(columns);
 #if DEBUG
-      foreach (row, numbers) {
-        foreach (it, *row) {
-          log("%ld ", *it);
-        }
+      for (size_t row = 0; row < csr_rows(&numbers); ++row) {
+        csr_foreach(it, &numbers, row) { log("%ld ", *it); }
         log("\n");
       }
 #endif
-      log_value(da_cap(numbers), "%ld");
-      log_value(da_len(numbers), "%ld");
+      log_value(csr_len(&numbers), "%ld");
+      log_value(csr_rows(&numbers), "%ld");
 
-      PerfMeasureLoopNamed("advance") {
-        unsigned char *q = memchr(data, '\n', da_len(data));
-        row_size = (size_t)(q - p) + 1;
-        while (p < end && (*p != '*' && *p != '+'))
-          p++;
-      }
+      p = ops;
 
       uint64_t sum = 0;
       PerfMeasureLoopNamed("sum") {
@@ -96,15 +105,11 @@ int main(int argc, char *argv[]) {
           switch (*p) {
           case '*': {
             acc = 1;
-            foreach (n, numbers[i]) {
-              acc *= *n;
-            }
+            csr_foreach(n, &numbers, i) { acc *= *n; }
           } break;
           case '+': {
             acc = 0;
-            foreach (n, numbers[i]) {
-              acc += *n;
-            }
+            csr_foreach(n, &numbers, i) { acc += *n; }
           } break;
           default: {
             fprintf(stderr, "Unexpected data at %ld(%d)\n", p - &data[0], *p);
@@ -120,10 +125,7 @@ int main(int argc, char *argv[]) {
       }
       print_value(sum, "%ld");
 
-      foreach (row, numbers) {
-        da_free(*row);
-      }
-      da_free(numbers);
+      csr_free(&numbers);
     } // DeferLoopEnd(da_free(data))
   } // PerfMeasureLoopNamed("entire")
   return EXIT_SUCCESS;
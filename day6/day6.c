@@ -1,20 +1,125 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memrchr
+#endif
+#include <ctype.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "../utils/csr.h"
 #include "../utils/da.h"
 #include "../utils/file.h"
 #include "../utils/numbers.h"
 #include "../utils/perf_measure.h"
 
+// Last occurrence of c in [p, p + n)
+static const unsigned char *find_last(const unsigned char *p, int c, size_t n) {
+#if defined(__GLIBC__)
+  return memrchr(p, c, n);
+#else
+  while (n > 0) {
+    if (p[--n] == (unsigned char)c)
+      return p + n;
+  }
+  return NULL;
+#endif
+}
+
+typedef struct {
+  uint64_t acc;
+  unsigned char op;
+} Column;
+
+/*
+ * Streaming mode: the operator row is located from the end of the mapped
+ * file, then the number rows are folded into one accumulator per column as
+ * they are read. Memory is O(columns) no matter how many rows there are.
+ */
+int solve_streaming(const char *path, uint64_t *sum) {
+  MappedFile map;
+  if (!map_entire_file(path, &map)) {
+    fprintf(stderr, "Error opening file\n");
+    return 0;
+  }
+
+  int ok = 1;
+  Column *columns = make(Column, 1000);
+  DeferLoopEnd((unmap_file(&map), da_free(columns))) {
+    log("Mapped bytes %ld\n", map.len);
+    const unsigned char *data = map.data;
+    size_t len = map.len;
+    while (len > 0 && isspace(data[len - 1]))
+      --len;
+    const unsigned char *nl = find_last(data, '\n', len);
+    const unsigned char *ops_line = nl ? nl + 1 : data;
+    const unsigned char *end = data + len;
+
+    PerfMeasureLoopNamed("operators") {
+      for (const unsigned char *q = ops_line; q < end; ++q) {
+        if (*q == '*' || *q == '+') {
+          Column c = {*q == '*' ? 1 : 0, *q};
+          append(columns, c);
+        }
+      }
+    }
+    log_value(da_len(columns), "%ld");
+
+    PerfMeasureLoopNamed("fold") {
+      unsigned char *p = (unsigned char *)data;
+      unsigned char *rows_end = (unsigned char *)ops_line;
+      while (p < rows_end) {
+        unsigned char *eol = memchr(p, '\n', (size_t)(rows_end - p));
+        if (!eol)
+          eol = rows_end;
+        size_t i = 0;
+        uint64_t num = 0;
+        while (parse_next_number(&p, eol, &num)) {
+          if (i >= da_len(columns)) {
+            fprintf(stderr, "Unexpected data at %ld(%d)\n",
+                    p - (unsigned char *)data, *p);
+            ok = 0;
+            break;
+          }
+          if (columns[i].op == '*') {
+            columns[i].acc *= num;
+          } else {
+            columns[i].acc += num;
+          }
+          ++i;
+        }
+        if (!ok)
+          break;
+        p = eol + 1;
+      }
+    }
+
+    *sum = 0;
+    foreach (it, columns) {
+      *sum += it->acc;
+    }
+  }
+  return ok;
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <file_input>\n", argv[0]);
+  if (argc < 2 || (argc > 2 && (argc != 3 || strcmp(argv[2], "--stream")))) {
+    fprintf(stderr, "Usage: %s <file_input> [--stream]\n", argv[0]);
     return 1;
   }
 
+  if (argc == 3) {
+    uint64_t sum = 0;
+    PerfMeasureLoopNamed("entire") {
+      if (!solve_streaming(argv[1], &sum))
+        return EXIT_FAILURE;
+    }
+    print_value(sum, "%lu");
+    return EXIT_SUCCESS;
+  }
+
   unsigned char *data = NULL;
 
   PerfMeasureLoopNamed("entire") {
@@ -29,76 +134,92 @@ int main(int argc, char *argv[]) {
 
     DeferLoopEnd(da_free(data)) {
       log("Read bytes %ld\n", da_len(data));
-      uint64_t **numbers = make(uint64_t *, 1000);
+      // One CSR row per worksheet row, columns are reduced across them
+      Csr numbers;
+      if (!csr_init(&numbers, 0)) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+      }
       PerfMeasureLoopNamed("parse") {
-        size_t i = 0;
         while (p < end && (*p != '*' && *p != '+')) {
           uint64_t num = 0;
           if (!parse_next_number(&p, end, &num)) {
             fprintf(stderr, "Unexpected data at %ld(%d)\n", p - &data[0], *p);
             return EXIT_FAILURE;
           }
-          if (i >= da_len(numbers)) {
-            append(numbers, make(uint64_t, 5));
-          }
-          append(numbers[i], num);
+          csr_push(&numbers, num);
           while (*p == ' ')
             ++p;
           if (*p == '\n') {
             ++p;
-            i = 0;
-          } else {
-            i++;
+            csr_end_row(&numbers);
+            // Lines are padded to one width, so the first row tells how
+            // many values the whole table holds
+            if (csr_rows(&numbers) == 1) {
+              size_t lines = da_len(data) / (size_t)(p - data);
+              if (!csr_reserve(&numbers, csr_len(&numbers) * lines)) {
+                fprintf(stderr, "Out of memory\n");
+                return EXIT_FAILURE;
+              }
+            }
           }
         }
       }
 #if DEBUG
-      foreach (row, numbers) {
-        foreach (it, *row) {
-          log("%ld ", *it);
-        }
+      for (size_t row = 0; row < csr_rows(&numbers); ++row) {
+        csr_foreach(it, &numbers, row) { log("%ld ", *it); }
         log("\n");
       }
 #endif
-      log_value(da_cap(numbers), "%ld");
-      log_value(da_len(numbers), "%ld");
+      log_value(csr_len(&numbers), "%ld");
+      log_value(csr_rows(&numbers), "%ld");
 
       uint64_t sum = 0;
+      int *ops = make(int, 1000);
       PerfMeasureLoopNamed("sum") {
-        size_t i = 0;
         while (p < end) {
-          uint64_t acc = 0;
-          switch (*p) {
-          case '*': {
-            acc = 1;
-            foreach (n, numbers[i]) {
-              acc *= *n;
-            }
-          } break;
-          case '+': {
-            acc = 0;
-            foreach (n, numbers[i]) {
-              acc += *n;
-            }
-          } break;
-          default: {
+          if (*p != '*' && *p != '+') {
             fprintf(stderr, "Unexpected data at %ld(%d)\n", p - &data[0], *p);
             return EXIT_FAILURE;
           }
-          }
+          append(ops, *p);
           ++p;
-          sum += acc;
           while (*p == ' ')
             ++p;
-          ++i;
         }
+
+        // Both reductions for every column, each row is one contiguous
+        // vectorizable pass, the operator picks the result at the end
+        size_t cols = da_len(ops);
+        uint64_t *sums = make(uint64_t, cols);
+        uint64_t *products = make(uint64_t, cols);
+        for (size_t i = 0; i < cols; ++i) {
+          sums[i] = 0;
+          products[i] = 1;
+        }
+        for (size_t row = 0; row < csr_rows(&numbers); ++row) {
+          const uint64_t *values = csr_row(&numbers, row);
+          size_t n = csr_row_len(&numbers, row);
+          if (n > cols) {
+            fprintf(stderr, "Row %zu has %zu numbers for %zu operators\n",
+                    row + 1, n, cols);
+            return EXIT_FAILURE;
+          }
+          for (size_t i = 0; i < n; ++i) {
+            sums[i] += values[i];
+            products[i] *= values[i];
+          }
+        }
+        for (size_t i = 0; i < cols; ++i) {
+          sum += ops[i] == '*' ? products[i] : sums[i];
+        }
+        da_free(sums);
+        da_free(products);
       }
       print_value(sum, "%lu");
 
-      foreach (row, numbers) {
-        da_free(*row);
-      }
-      da_free(numbers);
+      da_free(ops);
+      csr_free(&numbers);
     } // DeferLoopEnd(da_free(data))
   } // PerfMeasureLoopNamed("entire")
   return EXIT_SUCCESS;
@@ -0,0 +1,206 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/da.h"
+#include "../utils/file.h"
+#include "../utils/perf_measure.h"
+
+/*
+ * Beams fall one row at a time, so only the previous row of counters is
+ * needed: the manifold is streamed row by row through two rolling buffers
+ * and memory stays O(width) for any height.
+ *
+ * A row step is branch free. With prev the beam counts above a row:
+ *   split[j] = prev[j] where the row has '^', else 0
+ *   next[j]  = prev[j] where the row has '.' or '|', else 0
+ *              + split[j - 1] + split[j + 1]
+ * so a splitter sends its beams to both sides and the loops vectorize. The
+ * Odin version marks the cells next to a hit splitter as beams in place, so
+ * a lit splitter right of another one lets its beams through instead, as
+ * does a newline right of a lit splitter. Rows where that happens take the
+ * scalar step, which follows it cell by cell.
+ */
+typedef struct {
+  FILE *in;
+  size_t stride;       // row length including the newline
+  unsigned char *line; // current row, stride bytes
+  uint64_t *prev;
+  uint64_t *next;
+  uint64_t *pass;      // beams going straight down
+  uint64_t *split;     // beams hitting a splitter, stride + 2, zero padded
+} Beams;
+
+// The first row fixes the stride, the file is rewound so it is read again
+// like every other row. Returns 0 when there is no newline.
+int beams_open(Beams *b) {
+  size_t len = 0;
+  int c;
+  while ((c = fgetc(b->in)) != EOF) {
+    len++;
+    if (c == '\n')
+      break;
+  }
+  if (c != '\n' || fseek(b->in, 0, SEEK_SET) != 0)
+    return 0;
+  b->stride = len;
+  b->line = make(unsigned char, len);
+  return 1;
+}
+
+// Next row into b->line, a short last row is padded as if it ended the line
+int beams_read_row(Beams *b) {
+  size_t got = fread(b->line, 1, b->stride, b->in);
+  if (got == 0)
+    return 0;
+  memset(b->line + got, '\n', b->stride - got);
+  return 1;
+}
+
+// Cell by cell, marking the neighbours of a hit splitter like the Odin loop
+uint64_t beams_step_scalar(Beams *b) {
+  const size_t n = b->stride;
+  unsigned char *line = b->line;
+  uint64_t *prev = b->prev;
+  uint64_t *next = b->next;
+  uint64_t hits = 0;
+  memset(next, 0, n * sizeof(uint64_t));
+  for (size_t j = 0; j < n; ++j) {
+    uint64_t s = prev[j];
+    if (s == 0)
+      continue;
+    switch (line[j]) {
+    case '.':
+    case '|':
+      next[j] += s;
+      break;
+    case '^':
+      hits++;
+      // Left of the first column is the newline cell of the row above, it
+      // is read below only if a split from the last column overwrote ours
+      if (j > 0) {
+        line[j - 1] = '|';
+        next[j - 1] += s;
+      } else {
+        prev[n - 1] += s;
+      }
+      if (j + 1 < n) {
+        line[j + 1] = '|';
+        next[j + 1] += s;
+      }
+      break;
+    }
+  }
+  return hits;
+}
+
+// x != 0 as 0 or 1, without a compare on 64 bit lanes
+static inline uint64_t nonzero(uint64_t x) { return (x | -x) >> 63; }
+
+// Returns the number of splitters hit by beams in this row
+uint64_t beams_step(Beams *b) {
+  const size_t n = b->stride;
+  const unsigned char *line = b->line;
+  uint64_t *restrict prev = b->prev;
+  uint64_t *restrict next = b->next;
+  uint64_t *restrict split = b->split + 1;
+  uint64_t *restrict pass = b->pass;
+
+  // Compares stay on bytes, the baseline SSE2 has no 64 bit compare
+  uint64_t hits = 0;
+  for (size_t j = 0; j < n; ++j) {
+    unsigned char c = line[j];
+    uint64_t is_pass = (unsigned char)((c == '.') | (c == '|'));
+    uint64_t is_split = (unsigned char)(c == '^');
+    pass[j] = prev[j] & -is_pass;
+    split[j] = prev[j] & -is_split;
+    hits += nonzero(split[j]);
+  }
+  uint64_t adjacent = 0;
+  for (size_t j = 0; j < n; ++j) {
+    adjacent |= nonzero(split[j - 1]) & nonzero(split[j]);
+    next[j] = pass[j] + split[j - 1] + split[j + 1];
+  }
+  // A split from the last column overwrites the newline with a beam
+  if (n >= 2)
+    adjacent |= split[n - 2] != 0;
+  if (adjacent)
+    hits = beams_step_scalar(b);
+
+  b->prev = next;
+  b->next = prev;
+  return hits;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <file_input>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Beams b = {0};
+  b.in = fopen(argv[1], "rb");
+  if (!b.in) {
+    perror("Error opening file");
+    return EXIT_FAILURE;
+  }
+
+  PerfMeasureLoopNamed("entire") {
+    DeferLoopEnd(fclose(b.in)) {
+      if (!beams_open(&b)) {
+        fprintf(stderr, "Bad data: no newline in input file\n");
+        return EXIT_FAILURE;
+      }
+      log_value(b.stride, "%zu");
+
+      b.prev = make(uint64_t, b.stride);
+      b.next = make(uint64_t, b.stride);
+      b.split = make(uint64_t, b.stride + 2);
+      b.pass = make(uint64_t, b.stride);
+      memset(b.prev, 0, b.stride * sizeof(uint64_t));
+      memset(b.split, 0, (b.stride + 2) * sizeof(uint64_t));
+
+      // Rows above the start carry no beams
+      int started = 0;
+      uint64_t total_splits = 0;
+      size_t rows = 0;
+      PerfMeasureLoopNamed("propagate") {
+        while (beams_read_row(&b)) {
+          if (started) {
+            total_splits += beams_step(&b);
+          } else {
+            unsigned char *s = memchr(b.line, 'S', b.stride);
+            if (s) {
+              log("start_pos = %zu\n", (size_t)(s - b.line));
+              b.prev[s - b.line] = 1;
+              started = 1;
+            }
+          }
+          log_trace("row %zu: %lu splits so far\n", rows, total_splits);
+          rows++;
+        }
+      }
+
+      if (!started) {
+        fprintf(stderr, "Bad data: no start position found\n");
+        return EXIT_FAILURE;
+      }
+      print_value(total_splits, "%lu");
+
+      uint64_t sum = 0;
+      for (size_t j = 0; j < b.stride; ++j) {
+        sum += b.prev[j];
+      }
+      print_value(sum, "%lu");
+
+      da_free(b.line);
+      da_free(b.prev);
+      da_free(b.next);
+      da_free(b.split);
+      da_free(b.pass);
+    } // DeferLoopEnd(fclose(b.in))
+  } // PerfMeasureLoopNamed("entire")
+  return EXIT_SUCCESS;
+}
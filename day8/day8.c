@@ -0,0 +1,458 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/da.h"
+#include "../utils/dsu.h"
+#include "../utils/file.h"
+#include "../utils/numbers.h"
+#include "../utils/perf_measure.h"
+#include "../utils/threadpool.h"
+
+/*
+ * Pairs are generated by threadpool jobs, each owning a run of rows a with
+ * about the same number of pairs (a, b > a). A job walks its rows in tiles
+ * of TILE_ROWS x TILE_COLS so the b coordinates stay in L1 across the rows
+ * of a tile, and the distance kernel works on int32 coordinates with a
+ * widening multiply so it vectorizes.
+ *
+ * Pairs are packed records put in order by a parallel radix sort on the
+ * distance, see edges_sort. The sort is stable and the records go in (a, b)
+ * order, so ties come out by index like a stable sort of the full list.
+ *
+ * With a connections count only the closest pairs are needed: a first pass
+ * histograms the distances by their top bits, the bucket holding the
+ * count-th pair gives a cutoff, and the second pass writes only the pairs
+ * under it. That pass walks whole rows instead of tiles so its survivors
+ * come out in (a, b) order too.
+ */
+typedef struct {
+  uint32_t a, b;
+  uint64_t dist;
+} Edge;
+
+typedef struct {
+  int32_t *x, *y, *z;
+  uint32_t n;
+} Points;
+
+// Differences of int32 coordinates in [0, COORD_MAX] cannot overflow, and
+// the sum of three squared differences fits in a uint64
+#define COORD_MAX INT32_MAX
+#define TILE_ROWS 64
+#define TILE_COLS 2048
+#define HIST_BITS 12
+#define HIST_BUCKETS (1u << HIST_BITS)
+// Jobs per worker, so a slow one does not hold up the rest
+#define JOBS_PER_THREAD 4
+
+typedef struct {
+  const Points *pts;
+  uint32_t a_begin, a_end;
+  uint64_t *hist; // when set, only count distances >> shift
+  int shift;
+  uint64_t cutoff; // otherwise write the pairs with dist <= cutoff to out
+  Edge *out;
+  size_t kept; // pairs under the cutoff, from the histogram
+} pairs_job_t;
+
+// Pairs (a', b) with a' < a, where row a starts in the full list
+static inline size_t pairs_before(size_t a, size_t n) {
+  return a * (n - 1) - a * (a - 1) / 2;
+}
+
+static inline void distances(const Points *p, uint32_t a, uint32_t b0,
+                             uint32_t b1, uint64_t *restrict dist) {
+  const int32_t *restrict xs = p->x, *restrict ys = p->y, *restrict zs = p->z;
+  int32_t xa = xs[a], ya = ys[a], za = zs[a];
+  for (uint32_t b = b0; b < b1; ++b) {
+    int32_t dx = xs[b] - xa, dy = ys[b] - ya, dz = zs[b] - za;
+    uint32_t ax = (uint32_t)((dx ^ (dx >> 31)) - (dx >> 31));
+    uint32_t ay = (uint32_t)((dy ^ (dy >> 31)) - (dy >> 31));
+    uint32_t az = (uint32_t)((dz ^ (dz >> 31)) - (dz >> 31));
+    dist[b - b0] = (uint64_t)ax * ax + (uint64_t)ay * ay + (uint64_t)az * az;
+  }
+}
+
+static void pairs_job(void *arg) {
+  pairs_job_t *job = (pairs_job_t *)arg;
+  const Points *p = job->pts;
+  const size_t first = pairs_before(job->a_begin, p->n);
+  uint64_t dist[TILE_COLS];
+  size_t kept = 0;
+  // Survivors of a cutoff are appended as they come, a row at a time keeps
+  // them in (a, b) order
+  const uint32_t rows =
+      job->hist || job->cutoff == UINT64_MAX ? TILE_ROWS : 1;
+
+  for (uint32_t a0 = job->a_begin; a0 < job->a_end; a0 += rows) {
+    uint32_t a1 = job->a_end - a0 > rows ? a0 + rows : job->a_end;
+    for (uint32_t c0 = a0 + 1; c0 < p->n; c0 += TILE_COLS) {
+      uint32_t c1 = p->n - c0 > TILE_COLS ? c0 + TILE_COLS : p->n;
+      for (uint32_t a = a0; a < a1; ++a) {
+        uint32_t b0 = a + 1 > c0 ? a + 1 : c0;
+        if (b0 >= c1)
+          continue;
+        distances(p, a, b0, c1, dist);
+        if (job->hist) {
+          for (uint32_t b = b0; b < c1; ++b)
+            job->hist[dist[b - b0] >> job->shift]++;
+        } else if (job->cutoff == UINT64_MAX) {
+          // Every pair is kept, its slot follows from (a, b)
+          Edge *out = job->out + pairs_before(a, p->n) - first + (b0 - a - 1);
+          for (uint32_t b = b0; b < c1; ++b)
+            out[b - b0] = (Edge){a, b, dist[b - b0]};
+        } else {
+          for (uint32_t b = b0; b < c1; ++b) {
+            if (dist[b - b0] <= job->cutoff)
+              job->out[kept++] = (Edge){a, b, dist[b - b0]};
+          }
+        }
+      }
+    }
+  }
+}
+
+typedef struct {
+  const Edge *src;
+  Edge *dst;
+  size_t begin, end;
+  int shift;
+  size_t counts[256];
+} radix_job_t;
+
+// Counters are kept local, stores through dst could alias them otherwise
+static void radix_count_job(void *arg) {
+  radix_job_t *job = (radix_job_t *)arg;
+  size_t counts[256] = {0};
+  const Edge *src = job->src;
+  const int shift = job->shift;
+  for (size_t i = job->begin; i < job->end; ++i)
+    counts[(src[i].dist >> shift) & 0xFF]++;
+  memcpy(job->counts, counts, sizeof(counts));
+}
+
+static void radix_scatter_job(void *arg) {
+  radix_job_t *job = (radix_job_t *)arg;
+  size_t slots[256];
+  memcpy(slots, job->counts, sizeof(slots));
+  const Edge *src = job->src;
+  Edge *dst = job->dst;
+  const int shift = job->shift;
+  for (size_t i = job->begin; i < job->end; ++i) {
+    Edge e = src[i];
+    dst[slots[(e.dist >> shift) & 0xFF]++] = e;
+  }
+}
+
+typedef struct {
+  Edge *e;
+  Edge *tmp;
+  size_t n;
+  int bits; // low bits of dist still to sort on
+} bucket_job_t;
+
+// Digits of one LSD pass over a bucket. Wider digits save a pass, and the
+// 2^11 counters stay in L1 however big the bucket is. A bucket holds about
+// 1/256 of the edges, so it only fits in L2 for a few thousand points. Past
+// that every pass streams the bucket from memory.
+#define BUCKET_DIGIT_BITS 11
+
+// Serial LSD passes over one bucket, it ends back in e
+static void bucket_sort_job(void *arg) {
+  bucket_job_t *job = (bucket_job_t *)arg;
+  const uint64_t mask = (1u << BUCKET_DIGIT_BITS) - 1;
+  Edge *src = job->e, *dst = job->tmp;
+  for (int shift = 0; shift < job->bits; shift += BUCKET_DIGIT_BITS) {
+    size_t slots[1u << BUCKET_DIGIT_BITS] = {0};
+    for (size_t i = 0; i < job->n; ++i)
+      slots[(src[i].dist >> shift) & mask]++;
+    if (slots[(src[0].dist >> shift) & mask] == job->n)
+      continue;
+    size_t sum = 0;
+    for (size_t d = 0; d <= mask; ++d) {
+      size_t cnt = slots[d];
+      slots[d] = sum;
+      sum += cnt;
+    }
+    for (size_t i = 0; i < job->n; ++i)
+      dst[slots[(src[i].dist >> shift) & mask]++] = src[i];
+    Edge *t = src;
+    src = dst;
+    dst = t;
+  }
+  if (src != job->e)
+    memcpy(job->e, src, job->n * sizeof(Edge));
+}
+
+/*
+ * Stable radix sort of edges on dist. The first pass scatters on the top 8
+ * bits of max_dist in parallel: each job counts its slice, the slots for
+ * digit d of job j come after all smaller digits and after digit d of the
+ * earlier jobs, so the scatter keeps the input order. Each bucket is then
+ * finished with LSD passes on the bits left, one job each. Returns e or
+ * tmp, whichever ends up sorted.
+ */
+Edge *edges_sort(threadpool_t *pool, Edge *e, Edge *tmp, size_t n,
+                 uint64_t max_dist) {
+  if (n < 2 || max_dist == 0)
+    return e;
+  int bits = 64 - __builtin_clzll(max_dist);
+  int top = bits > 8 ? bits - 8 : 0;
+
+  size_t njobs = (size_t)pool->nthreads * JOBS_PER_THREAD;
+  if (njobs > n / 4096 + 1)
+    njobs = n / 4096 + 1;
+  radix_job_t *jobs = make(radix_job_t, njobs);
+  for (size_t j = 0; j < njobs; ++j) {
+    jobs[j] = (radix_job_t){.src = e,
+                            .dst = tmp,
+                            .begin = n * j / njobs,
+                            .end = n * (j + 1) / njobs,
+                            .shift = top};
+    threadpool_submit(pool, radix_count_job, &jobs[j]);
+  }
+  threadpool_wait(pool);
+
+  size_t starts[257];
+  size_t sum = 0;
+  for (int d = 0; d < 256; ++d) {
+    starts[d] = sum;
+    for (size_t j = 0; j < njobs; ++j) {
+      size_t cnt = jobs[j].counts[d];
+      jobs[j].counts[d] = sum;
+      sum += cnt;
+    }
+  }
+  starts[256] = sum;
+  for (size_t j = 0; j < njobs; ++j)
+    threadpool_submit(pool, radix_scatter_job, &jobs[j]);
+  threadpool_wait(pool);
+  da_free(jobs);
+
+  bucket_job_t buckets[256];
+  for (int d = 0; d < 256; ++d) {
+    buckets[d] = (bucket_job_t){tmp + starts[d], e + starts[d],
+                                starts[d + 1] - starts[d], top};
+    if (buckets[d].n > 1 && top > 0)
+      threadpool_submit(pool, bucket_sort_job, &buckets[d]);
+  }
+  threadpool_wait(pool);
+  return tmp;
+}
+
+// Row ranges with about the same number of pairs each
+pairs_job_t *split_rows(const Points *p, size_t njobs) {
+  pairs_job_t *jobs = make(pairs_job_t, njobs);
+  size_t total = pairs_before(p->n, p->n);
+  uint32_t a = 0;
+  for (size_t j = 0; j < njobs && a < p->n; ++j) {
+    size_t until = total * (j + 1) / njobs;
+    uint32_t end = a + 1;
+    while (end < p->n && pairs_before(end, p->n) < until)
+      end++;
+    if (j == njobs - 1)
+      end = p->n;
+    pairs_job_t job = {.pts = p, .a_begin = a, .a_end = end};
+    append(jobs, job);
+    a = end;
+  }
+  return jobs;
+}
+
+/*
+ * Pairs sorted by distance into *out, returns how many. With limit > 0 the
+ * closest limit pairs are there, plus the rest of their histogram bucket,
+ * otherwise all of them.
+ */
+size_t closest_pairs(threadpool_t *pool, const Points *p, size_t limit,
+                     Edge **out) {
+  size_t total = pairs_before(p->n, p->n);
+  pairs_job_t *jobs = split_rows(p, (size_t)pool->nthreads * JOBS_PER_THREAD);
+
+  int32_t lo[3] = {INT32_MAX, INT32_MAX, INT32_MAX};
+  int32_t hi[3] = {INT32_MIN, INT32_MIN, INT32_MIN};
+  for (uint32_t i = 0; i < p->n; ++i) {
+    int32_t v[3] = {p->x[i], p->y[i], p->z[i]};
+    for (int k = 0; k < 3; ++k) {
+      lo[k] = v[k] < lo[k] ? v[k] : lo[k];
+      hi[k] = v[k] > hi[k] ? v[k] : hi[k];
+    }
+  }
+  uint64_t max_dist = 0;
+  for (int k = 0; k < 3 && p->n > 0; ++k) {
+    uint64_t d = (uint64_t)((int64_t)hi[k] - lo[k]);
+    max_dist += d * d;
+  }
+
+  uint64_t cutoff = UINT64_MAX;
+  size_t kept = total;
+  if (limit > 0 && limit < total) {
+    int shift = 0;
+    while ((max_dist >> shift) >= HIST_BUCKETS)
+      shift++;
+    PerfMeasureLoopNamed("histogram") {
+      foreach (job, jobs) {
+        job->hist = make(uint64_t, HIST_BUCKETS);
+        memset(job->hist, 0, HIST_BUCKETS * sizeof(uint64_t));
+        job->shift = shift;
+        threadpool_submit(pool, pairs_job, job);
+      }
+      threadpool_wait(pool);
+    }
+
+    size_t bucket = 0;
+    for (size_t below = 0; bucket < HIST_BUCKETS; ++bucket) {
+      foreach (job, jobs) {
+        below += job->hist[bucket];
+      }
+      if (below >= limit)
+        break;
+    }
+    cutoff = ((uint64_t)(bucket + 1) << shift) - 1;
+    // Each job knows how many of its pairs fall under the cutoff, which
+    // places its output
+    kept = 0;
+    foreach (job, jobs) {
+      for (size_t d = 0; d <= bucket; ++d)
+        job->kept += job->hist[d];
+      kept += job->kept;
+      da_free(job->hist);
+      job->hist = NULL;
+    }
+    log("cutoff = %lu keeps %zu of %zu pairs\n", cutoff, kept, total);
+  }
+
+  Edge *edges = make(Edge, kept ? kept : 1);
+  Edge *tmp = make(Edge, kept ? kept : 1);
+  PerfMeasureLoopNamed("pairs") {
+    size_t offset = 0;
+    foreach (job, jobs) {
+      job->cutoff = cutoff;
+      job->out = edges + offset;
+      offset += cutoff == UINT64_MAX ? pairs_before(job->a_end, p->n) -
+                                           pairs_before(job->a_begin, p->n)
+                                     : job->kept;
+      threadpool_submit(pool, pairs_job, job);
+    }
+    threadpool_wait(pool);
+  }
+
+  Edge *sorted = edges;
+  PerfMeasureLoopNamed("sort") {
+    sorted = edges_sort(pool, edges, tmp, kept, max_dist);
+  }
+  da_free(sorted == edges ? tmp : edges);
+  da_free(jobs);
+  *out = sorted;
+  return kept;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <file_input> <connections>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  char *count_end;
+  long long count_arg = strtoll(argv[2], &count_end, 10);
+  if (*argv[2] == '\0' || *count_end != '\0' || count_arg < 0) {
+    fprintf(stderr, "Error parsing count. Should be a number\n");
+    return EXIT_FAILURE;
+  }
+
+  unsigned char *data = NULL;
+  PerfMeasureLoopNamed("entire") {
+    PerfMeasureLoopNamed("read") {
+      if (!read_entire_file(argv[1], &data)) {
+        perror("Error reading file");
+        return EXIT_FAILURE;
+      }
+    }
+    DeferLoopEnd(da_free(data)) {
+      Points pts = {make(int32_t, 1024), make(int32_t, 1024),
+                    make(int32_t, 1024), 0};
+      unsigned char *p = data;
+      unsigned char *end = data + da_len(data);
+      uint64_t v[3];
+      while (parse_next_number(&p, end, &v[0]) &&
+             parse_next_number(&p, end, &v[1]) &&
+             parse_next_number(&p, end, &v[2])) {
+        if (v[0] > COORD_MAX || v[1] > COORD_MAX || v[2] > COORD_MAX) {
+          fprintf(stderr,
+                  "Coordinate out of range in point %zu. Should be at most "
+                  "%d\n",
+                  da_len(pts.x) + 1, COORD_MAX);
+          return EXIT_FAILURE;
+        }
+        append(pts.x, (int32_t)v[0]);
+        append(pts.y, (int32_t)v[1]);
+        append(pts.z, (int32_t)v[2]);
+      }
+      pts.n = (uint32_t)da_len(pts.x);
+      log_value(pts.n, "%u");
+
+      size_t total = pairs_before(pts.n, pts.n);
+      size_t count = (size_t)count_arg;
+      if (count == 0 || count > total)
+        count = total;
+
+      threadpool_t pool;
+      if (threadpool_init(&pool, 0) != 0) {
+        fprintf(stderr, "Failed to initialize thread pool\n");
+        return EXIT_FAILURE;
+      }
+      Edge *edges = NULL;
+      // All pairs are needed to connect everything when no count is given
+      size_t n_edges =
+          closest_pairs(&pool, &pts, count == total ? 0 : count, &edges);
+      threadpool_destroy(&pool);
+      log_value(n_edges, "%zu");
+
+      Dsu dsu;
+      if (!dsu_init(&dsu, (int32_t)pts.n)) {
+        fprintf(stderr, "Allocation Error\n");
+        return EXIT_FAILURE;
+      }
+      PerfMeasureLoopNamed("dsu") {
+        for (size_t i = 0; i < count && i < n_edges; ++i) {
+          Edge e = edges[i];
+          log_trace("%u<=>%u = %lu\n", e.a, e.b, e.dist);
+          if (dsu_union(&dsu, (int32_t)e.a, (int32_t)e.b) &&
+              dsu_count(&dsu) == 1) {
+            printf("a.x * b.x = %lld\n",
+                   (long long)pts.x[e.a] * (long long)pts.x[e.b]);
+            break;
+          }
+        }
+      }
+
+      // Three largest circuits
+      int64_t top[3] = {0, 0, 0};
+      for (uint32_t i = 0; i < pts.n; ++i) {
+        if (dsu_find(&dsu, (int32_t)i) != (int32_t)i)
+          continue;
+        int64_t sz = dsu.size[i];
+        for (int k = 0; k < 3; ++k) {
+          if (sz > top[k]) {
+            int64_t t = top[k];
+            top[k] = sz;
+            sz = t;
+          }
+        }
+      }
+      int64_t mult = 1;
+      for (int k = 0; k < 3 && top[k] > 0; ++k)
+        mult *= top[k];
+      print_value(mult, "%ld");
+
+      dsu_free(&dsu);
+      da_free(edges);
+      da_free(pts.x);
+      da_free(pts.y);
+      da_free(pts.z);
+    } // DeferLoopEnd(da_free(data))
+  } // PerfMeasureLoopNamed("entire")
+  return EXIT_SUCCESS;
+}
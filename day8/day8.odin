@@ -53,36 +53,18 @@ main :: proc() {
 		fmt.println(vectors[:])
 	}
 
-	distances := make([dynamic]Vec3_Distance, 0, len(vectors) * (len(vectors) - 1) / 2)
-	for vec_a, ai in vectors {
-		for vec_b, bi in vectors[ai + 1:] {
-			append(&distances, Vec3_Distance{ai, ai + bi + 1, vec3_distance(vec_a, vec_b)})
-		}
-	}
-	slice.sort_by_cmp(
-		distances[:],
-		#force_inline proc(a: Vec3_Distance, b: Vec3_Distance) -> slice.Ordering {
-			if a.distance > b.distance {
-				return .Greater
-			} else if a.distance < b.distance {
-				return .Less
-			} else {
-				return .Equal
-			}
-		},
-	)
-	when ODIN_DEBUG {
-		fmt.println("=== Distances")
-		for d in distances {
-			fmt.printfln("%v<=>%v = %v", vectors[d.a], vectors[d.b], d.distance)
-		}
-	}
+	// Pairs come out in increasing distance, ties by index, without building
+	// all n(n-1)/2 of them
+	pairs := pairs_init(vectors[:])
 
-	if count == 0 do count = len(distances)
+	total := len(vectors) * (len(vectors) - 1) / 2
+	if count == 0 || count > total do count = total
 
 	dsu := dsu_init(len(vectors))
 	when ODIN_DEBUG do fmt.println("DSU", count)
-	for d in distances[:count] {
+	for _ in 0 ..< count {
+		d, ok := pairs_next(&pairs)
+		if !ok do break
 		when ODIN_DEBUG do fmt.printfln(
 			"%v:%v<=>%v:%v = %v",
 			d.a,
@@ -136,6 +118,198 @@ vec3_distance :: #force_inline proc(a: Vec3, b: Vec3) -> uint {
 	return vec3_length2(b - a)
 }
 
+// Implicit k-d tree: the median of every order range is its node, split on
+// the axis depth % 3
+Kd_Tree :: struct {
+	points: []Vec3,
+	order:  []int,
+}
+
+kd_build :: proc(t: ^Kd_Tree, lo, hi, depth: int) {
+	if hi - lo <= 1 do return
+	mid := lo + (hi - lo) / 2
+	kd_select(t, lo, hi, mid, depth % 3)
+	kd_build(t, lo, mid, depth + 1)
+	kd_build(t, mid + 1, hi, depth + 1)
+}
+
+// Quickselect with a three way partition, so runs of equal coordinates
+// do not make it quadratic
+kd_select :: proc(t: ^Kd_Tree, lo, hi, nth, axis: int) {
+	lo, hi := lo, hi
+	order := t.order
+	for hi - lo > 1 {
+		pivot := t.points[order[lo + (hi - lo) / 2]][axis]
+		lt, i, gt := lo, lo, hi
+		for i < gt {
+			v := t.points[order[i]][axis]
+			if v < pivot {
+				order[lt], order[i] = order[i], order[lt]
+				lt += 1
+				i += 1
+			} else if v > pivot {
+				gt -= 1
+				order[gt], order[i] = order[i], order[gt]
+			} else {
+				i += 1
+			}
+		}
+		if nth < lt {
+			hi = lt
+		} else if nth >= gt {
+			lo = gt
+		} else {
+			return
+		}
+	}
+}
+
+Neighbor :: struct {
+	distance: uint,
+	idx:      int,
+}
+
+neighbor_less :: proc(a, b: Neighbor) -> bool {
+	if a.distance != b.distance do return a.distance < b.distance
+	return a.idx < b.idx
+}
+
+neighbor_greater :: proc(a, b: Neighbor) -> bool {
+	return neighbor_less(b, a)
+}
+
+// The k nearest points to q, as a max heap in best
+kd_knn :: proc(t: ^Kd_Tree, lo, hi, depth, q, k: int, best: ^[dynamic]Neighbor) {
+	if lo >= hi do return
+	mid := lo + (hi - lo) / 2
+	p := t.order[mid]
+	if p != q {
+		n := Neighbor{vec3_distance(t.points[q], t.points[p]), p}
+		if len(best^) < k {
+			append(best, n)
+			heap_sift_up(best^[:], len(best^) - 1, neighbor_greater)
+		} else if neighbor_less(n, best^[0]) {
+			best^[0] = n
+			heap_sift_down(best^[:], 0, neighbor_greater)
+		}
+	}
+
+	axis := depth % 3
+	diff := int(t.points[q][axis]) - int(t.points[p][axis])
+	near_lo, near_hi, far_lo, far_hi := lo, mid, mid + 1, hi
+	if diff >= 0 {
+		near_lo, near_hi, far_lo, far_hi = mid + 1, hi, lo, mid
+	}
+	kd_knn(t, near_lo, near_hi, depth + 1, q, k, best)
+	// Ties go by index, so an equal distance behind the plane still counts
+	if len(best^) < k || uint(diff * diff) <= best^[0].distance {
+		kd_knn(t, far_lo, far_hi, depth + 1, q, k, best)
+	}
+}
+
+NEIGHBOR_BATCH :: 4
+
+// Neighbors of one point in order, batch holds the ranks from base on.
+// Running out queries the tree again for twice as many.
+Neighbor_Stream :: struct {
+	batch: [dynamic]Neighbor,
+	base:  int,
+}
+
+stream_get :: proc(t: ^Kd_Tree, s: ^Neighbor_Stream, q, rank: int) -> (n: Neighbor, ok: bool) {
+	others := len(t.points) - 1
+	if rank >= others do return
+	if rank >= s.base + len(s.batch) {
+		k := min(max(NEIGHBOR_BATCH, 2 * rank), others)
+		clear(&s.batch)
+		kd_knn(t, 0, len(t.order), 0, q, k, &s.batch)
+		slice.sort_by(s.batch[:], neighbor_less)
+		remove_range(&s.batch, 0, rank)
+		s.base = rank
+	}
+	return s.batch[rank - s.base], true
+}
+
+// Head of a neighbor stream, the pair is lo < hi
+Candidate :: struct {
+	distance: uint,
+	lo, hi:   int,
+	from:     int,
+	rank:     int,
+}
+
+candidate_less :: proc(a, b: Candidate) -> bool {
+	if a.distance != b.distance do return a.distance < b.distance
+	if a.lo != b.lo do return a.lo < b.lo
+	return a.hi < b.hi
+}
+
+// Merges the neighbor streams of all points through a heap of their heads
+Pair_Stream :: struct {
+	tree:      Kd_Tree,
+	neighbors: []Neighbor_Stream,
+	heap:      [dynamic]Candidate,
+}
+
+pairs_init :: proc(vectors: []Vec3) -> (s: Pair_Stream) {
+	s.tree.points = vectors
+	s.tree.order = make([]int, len(vectors))
+	for i in 0 ..< len(vectors) do s.tree.order[i] = i
+	kd_build(&s.tree, 0, len(vectors), 0)
+
+	s.neighbors = make([]Neighbor_Stream, len(vectors))
+	s.heap = make([dynamic]Candidate, 0, len(vectors))
+	for i in 0 ..< len(vectors) do pairs_push(&s, i, 0)
+	return
+}
+
+pairs_push :: proc(s: ^Pair_Stream, from, rank: int) {
+	n, ok := stream_get(&s.tree, &s.neighbors[from], from, rank)
+	if !ok do return
+	append(&s.heap, Candidate{n.distance, min(from, n.idx), max(from, n.idx), from, rank})
+	heap_sift_up(s.heap[:], len(s.heap) - 1, candidate_less)
+}
+
+pairs_next :: proc(s: ^Pair_Stream) -> (d: Vec3_Distance, ok: bool) {
+	for len(s.heap) > 0 {
+		top := s.heap[0]
+		last := pop(&s.heap)
+		if len(s.heap) > 0 {
+			s.heap[0] = last
+			heap_sift_down(s.heap[:], 0, candidate_less)
+		}
+		pairs_push(s, top.from, top.rank + 1)
+		// Every pair comes up from both of its points, the lower one reports it
+		if top.from == top.lo {
+			return Vec3_Distance{top.lo, top.hi, top.distance}, true
+		}
+	}
+	return
+}
+
+heap_sift_up :: proc(q: []$T, i: int, less: proc(a, b: T) -> bool) {
+	i := i
+	for i > 0 {
+		parent := (i - 1) / 2
+		if !less(q[i], q[parent]) do break
+		q[i], q[parent] = q[parent], q[i]
+		i = parent
+	}
+}
+
+heap_sift_down :: proc(q: []$T, i: int, less: proc(a, b: T) -> bool) {
+	i := i
+	for {
+		m := i
+		l, r := 2 * i + 1, 2 * i + 2
+		if l < len(q) && less(q[l], q[m]) do m = l
+		if r < len(q) && less(q[r], q[m]) do m = r
+		if m == i do break
+		q[i], q[m] = q[m], q[i]
+		i = m
+	}
+}
+
 DSU :: struct {
 	parent: []int,
 	size:   []int,
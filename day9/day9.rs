@@ -1,8 +1,9 @@
 use std::{
-    collections::BinaryHeap,
+    cmp::Reverse,
     env, fs,
     io::{self, Read},
     ops::Add,
+    sync::atomic::{AtomicUsize, Ordering},
 };
 
 use advent2025::{debug_block, debug_println, perf};
@@ -28,6 +29,7 @@ impl Coord {
 struct Rect {
     a: Coord,
     b: Coord,
+    #[allow(dead_code)] // only printed
     area: usize,
 }
 
@@ -56,26 +58,22 @@ impl From<(&Coord, &Coord)> for Rect {
     }
 }
 
-impl PartialOrd for Rect {
-    fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
-        Some(self.cmp(other))
-    }
-}
+/// Pair i < j with its area, ordered so the max is the largest area and,
+/// among equal ones, the first pair in input order
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+struct Candidate(usize, Reverse<usize>, Reverse<usize>);
 
-impl PartialEq for Rect {
-    fn eq(&self, other: &Self) -> bool {
-        self.area.eq(&other.area)
+impl Candidate {
+    fn new(coords: &[Coord], i: usize, j: usize) -> Self {
+        let (i, j) = (i.min(j), i.max(j));
+        Candidate(coords[i].area(&coords[j]), Reverse(i), Reverse(j))
     }
-}
 
-impl Ord for Rect {
-    fn cmp(&self, other: &Self) -> std::cmp::Ordering {
-        self.area.cmp(&other.area)
+    fn rect(&self, coords: &[Coord]) -> Rect {
+        Rect::from((&coords[self.1.0], &coords[self.2.0]))
     }
 }
 
-impl Eq for Rect {}
-
 fn main() -> io::Result<()> {
     let args: Vec<String> = env::args().collect();
     let Some(file_path) = args.get(1) else {
@@ -124,33 +122,118 @@ fn main() -> io::Result<()> {
     Ok(())
 }
 
+/// Points no other point beats in the direction scanned: walking `order`,
+/// a point joins when its y is at least as good as every y before it. Ties
+/// are kept, a dominated point only adds a candidate.
+fn front(coords: &[Coord], order: impl Iterator<Item = usize>, lower: bool) -> Vec<usize> {
+    let mut front = Vec::new();
+    let mut edge: Option<usize> = None;
+    for i in order {
+        let y = coords[i].y;
+        if edge.is_none_or(|e| if lower { y <= e } else { y >= e }) {
+            edge = Some(y);
+            front.push(i);
+        }
+    }
+    front
+}
+
+/// A corner that another point dominates towards the outside can be swapped
+/// for it and the rectangle grows, so the largest one has both corners on
+/// the staircase fronts of the points: lower-left against upper-right, or
+/// upper-left against lower-right. Corners whose best case inside the
+/// bounding box cannot reach the running best are skipped.
 fn solve_part1(coords: &[Coord]) -> Rect {
-    let mut squares: BinaryHeap<Rect> = perf!("squares", {
-        coords
-            .iter()
-            .tuple_combinations::<(&Coord, &Coord)>()
-            .map_into::<Rect>()
-            .collect()
+    let (lower_left, upper_right, upper_left, lower_right) = perf!("fronts", {
+        let mut order: Vec<usize> = (0..coords.len()).collect();
+        order.sort_unstable_by_key(|&i| (coords[i].x, coords[i].y));
+        (
+            front(coords, order.iter().copied(), true),
+            front(coords, order.iter().rev().copied(), false),
+            front(coords, order.iter().copied(), false),
+            front(coords, order.iter().rev().copied(), true),
+        )
+    });
+    debug_println!("fronts = {lower_left:?} {upper_right:?} {upper_left:?} {lower_right:?}");
+
+    let (min, max) = coords.iter().fold(
+        (Coord::new(usize::MAX, usize::MAX), Coord::new(0, 0)),
+        |(lo, hi), c| {
+            (
+                Coord::new(lo.x.min(c.x), lo.y.min(c.y)),
+                Coord::new(hi.x.max(c.x), hi.y.max(c.y)),
+            )
+        },
+    );
+    let mut best: Option<Candidate> = None;
+    perf!("search", {
+        for (corners, opposite) in [(&lower_left, &upper_right), (&upper_left, &lower_right)] {
+            for &i in corners {
+                let c = coords[i];
+                let reach = (c.x.abs_diff(min.x).max(c.x.abs_diff(max.x)) + 1)
+                    * (c.y.abs_diff(min.y).max(c.y.abs_diff(max.y)) + 1);
+                if best.is_some_and(|b| reach < b.0) {
+                    continue;
+                }
+                for &j in opposite.iter().filter(|&&j| j != i) {
+                    best = best.max(Some(Candidate::new(coords, i, j)));
+                }
+            }
+        }
     });
+    best.expect("Should be at least one square").rect(coords)
+}
+
+/// One axis of the compressed map. Every distinct vertex coordinate gets a
+/// line of its own and every gap between two of them a single line, plus a
+/// margin line on the outside, so each compressed cell stands for a block of
+/// cells that the border and the fill treat the same way.
+struct Axis {
+    values: Vec<usize>,
+    lines: Vec<usize>,
+    len: usize,
+}
+
+impl Axis {
+    fn new(coords: impl Iterator<Item = usize>) -> Self {
+        let values: Vec<usize> = coords.sorted_unstable().dedup().collect();
+        let mut lines = Vec::with_capacity(values.len());
+        let mut len = usize::from(values.first().is_some_and(|&v| v > 0));
+        for (i, &v) in values.iter().enumerate() {
+            lines.push(len);
+            len += 1;
+            if values.get(i + 1).is_some_and(|&next| next - v > 1) {
+                len += 1;
+            }
+        }
+        Axis {
+            values,
+            lines,
+            len: len + 1,
+        }
+    }
 
-    debug_println!("{squares:?}");
-    squares.pop().expect("Should be at least one square")
+    fn line(&self, v: usize) -> usize {
+        self.lines[self.values.binary_search(&v).expect("Vertex coordinate")]
+    }
 }
 
 fn solve_part2(coords: &[Coord]) -> Rect {
-    let (mut max_x, mut max_y) = perf!("map_dimensions", {
-        coords
-            .iter()
-            .fold((1, 1), |(x, y), c| (x.max(c.x), y.max(c.y)))
+    let (xs, ys) = perf!("compress", {
+        (
+            Axis::new(coords.iter().map(|c| c.x)),
+            Axis::new(coords.iter().map(|c| c.y)),
+        )
     });
-    max_x += 3;
-    max_y += 3;
+    let (max_x, max_y) = (xs.len, ys.len);
     debug_println!("dimensions = ({max_x}, {max_y})");
     let mut map = vec![false; max_y * max_x];
     perf!("map_border", {
         for (c1, c2) in coords.iter().circular_tuple_windows() {
-            for y in c1.y.min(c2.y)..=c1.y.max(c2.y) {
-                for x in c1.x.min(c2.x)..=c1.x.max(c2.x) {
+            let (x1, x2) = (xs.line(c1.x), xs.line(c2.x));
+            let (y1, y2) = (ys.line(c1.y), ys.line(c2.y));
+            for y in y1.min(y2)..=y1.max(y2) {
+                for x in x1.min(x2)..=x1.max(x2) {
                     map[index_2d(max_x, x, y)] = true
                 }
             }
@@ -165,69 +248,56 @@ fn solve_part2(coords: &[Coord]) -> Rect {
         }
     });
 
+    // The first cell of every run between borders decides the run by looking
+    // for a set cell in each direction. Above and to the left that includes
+    // cells filled earlier, which running flags track; below and to the right
+    // only the border is set yet, so its last row and column answer in O(1).
     perf!("map_fill", {
+        let mut last_row = vec![None; max_x];
+        let mut last_col = vec![None; max_y];
+        for y in 0..max_y {
+            for x in 0..max_x {
+                if map[index_2d(max_x, x, y)] {
+                    last_row[x] = Some(y);
+                    last_col[y] = Some(x);
+                }
+            }
+        }
+
         enum State {
             Unknown,
             KnownInside,
             KnownOutside,
         }
         let mut state = State::Unknown;
+        let mut seen_above = vec![false; max_x];
         for y in 0..max_y {
+            let mut seen_left = false;
             for x in 0..max_x {
                 let i = index_2d(max_x, x, y);
                 if map[i] {
                     state = State::Unknown;
-                    continue;
-                }
-                match state {
-                    State::KnownOutside => {}
-                    State::KnownInside => map[i] = true,
-                    State::Unknown => {
-                        state = State::KnownOutside;
-                        let mut has_top_border = false;
-                        for cy in 0..y {
-                            if map[index_2d(max_x, x, cy)] {
-                                has_top_border = true;
-                                break;
-                            }
-                        }
-                        if !has_top_border {
-                            continue;
-                        }
-                        let mut has_bottom_border = false;
-                        for cy in y + 1..max_y {
-                            if map[index_2d(max_x, x, cy)] {
-                                has_bottom_border = true;
-                                break;
+                } else {
+                    match state {
+                        State::KnownOutside => {}
+                        State::KnownInside => map[i] = true,
+                        State::Unknown => {
+                            state = State::KnownOutside;
+                            if seen_above[x]
+                                && last_row[x].is_some_and(|r| r > y)
+                                && seen_left
+                                && last_col[y].is_some_and(|c| c > x)
+                            {
+                                map[i] = true;
+                                state = State::KnownInside;
                             }
                         }
-                        if !has_bottom_border {
-                            continue;
-                        }
-                        let mut has_left_border = false;
-                        for cx in 0..x {
-                            if map[index_2d(max_x, cx, y)] {
-                                has_left_border = true;
-                                break;
-                            }
-                        }
-                        if !has_left_border {
-                            continue;
-                        }
-                        let mut has_right_border = false;
-                        for cx in x + 1..max_x {
-                            if map[index_2d(max_x, cx, y)] {
-                                has_right_border = true;
-                                break;
-                            }
-                        }
-                        if !has_right_border {
-                            continue;
-                        }
-                        map[i] = true;
-                        state = State::KnownInside;
-                    }
-                };
+                    };
+                }
+                seen_left |= map[i];
+            }
+            for x in 0..max_x {
+                seen_above[x] |= map[index_2d(max_x, x, y)];
             }
         }
     });
@@ -240,29 +310,57 @@ fn solve_part2(coords: &[Coord]) -> Rect {
         }
     });
 
-    // Only if i knew how to calculate polygons
-    let mut squares: BinaryHeap<Rect> = perf!("squares", {
-        coords
-            .iter()
-            .tuple_combinations::<(&Coord, &Coord)>()
-            .map_into::<Rect>()
-            .par_bridge()
-            .filter(|r| {
-                let (r_x, r_y) = r.points();
-                for y in r_y {
-                    for x in r_x.clone() {
-                        if !map[index_2d(max_x, x, y)] {
-                            return false;
-                        }
+    // Summed-area table of set cells, a rectangle is inside when all of its
+    // compressed cells are set
+    let stride = max_x + 1;
+    let sums = perf!("prefix_sums", {
+        let mut sums = vec![0u32; (max_y + 1) * stride];
+        for y in 0..max_y {
+            let mut row = 0;
+            for x in 0..max_x {
+                row += map[index_2d(max_x, x, y)] as u32;
+                sums[index_2d(stride, x + 1, y + 1)] = sums[index_2d(stride, x + 1, y)] + row;
+            }
+        }
+        sums
+    });
+
+    let inside = |r: &Rect| {
+        let (r_x, r_y) = r.points();
+        let (x0, x1) = (xs.line(*r_x.start()), xs.line(*r_x.end()) + 1);
+        let (y0, y1) = (ys.line(*r_y.start()), ys.line(*r_y.end()) + 1);
+        let set = sums[index_2d(stride, x1, y1)] + sums[index_2d(stride, x0, y0)]
+            - sums[index_2d(stride, x0, y1)]
+            - sums[index_2d(stride, x1, y0)];
+        set as usize == (x1 - x0) * (y1 - y0)
+    };
+
+    // Max-reduction over the rows of pairs. The best area found by any worker
+    // so far rejects a pair before its rectangle is checked; equal areas are
+    // still checked so the first pair in input order wins like in part 1.
+    let found = AtomicUsize::new(0);
+    let best = perf!("squares", {
+        (0..coords.len())
+            .into_par_iter()
+            .filter_map(|i| {
+                let mut best: Option<Candidate> = None;
+                for j in i + 1..coords.len() {
+                    let c = Candidate::new(coords, i, j);
+                    if c.0 < found.load(Ordering::Relaxed) || best.is_some_and(|b| b >= c) {
+                        continue;
+                    }
+                    if inside(&c.rect(coords)) {
+                        found.fetch_max(c.0, Ordering::Relaxed);
+                        best = Some(c);
                     }
                 }
-                true
+                best
             })
-            .collect()
+            .max()
     });
 
-    debug_println!("{squares:?}");
-    squares.pop().expect("Should be at least one square")
+    debug_println!("{best:?}");
+    best.expect("Should be at least one square").rect(coords)
 }
 
 fn index_2d(size: usize, x: usize, y: usize) -> usize {
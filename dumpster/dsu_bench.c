@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../utils/dsu.h"
+#include "../utils/perf_measure.h"
+#include "../utils/threadpool.h"
+
+/*
+ * utils/dsu.h against the recursive DSU of day8.odin: word sized parent and
+ * size arrays, recursive find with full path compression, union by size.
+ *
+ *   dsu_bench [n] [threads]
+ *
+ * n random unions over n elements, then n random finds, reported in
+ * million operations per second. The atomic unions run once on a single
+ * thread and once from the threadpool in edge batches.
+ */
+
+typedef struct {
+  int64_t *parent;
+  int64_t *size;
+  int64_t count;
+} RecDsu;
+
+int64_t rec_find(RecDsu *d, int64_t x) {
+  int64_t p = d->parent[x];
+  if (p != x)
+    d->parent[x] = rec_find(d, p);
+  return d->parent[x];
+}
+
+int rec_union(RecDsu *d, int64_t a, int64_t b) {
+  int64_t ra = rec_find(d, a);
+  int64_t rb = rec_find(d, b);
+  if (ra == rb)
+    return 0;
+  if (d->size[ra] < d->size[rb]) {
+    int64_t t = ra;
+    ra = rb;
+    rb = t;
+  }
+  d->parent[rb] = ra;
+  d->size[ra] += d->size[rb];
+  d->count--;
+  return 1;
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static inline uint64_t rng_next(void) {
+  uint64_t x = rng_state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return rng_state = x;
+}
+
+#define EDGE_BATCH (1 << 16)
+
+typedef struct {
+  Dsu *d;
+  const int32_t *edges; /* pairs */
+  size_t n;
+} union_job_t;
+
+static void union_job(void *arg) {
+  union_job_t *job = (union_job_t *)arg;
+  for (size_t i = 0; i < job->n; ++i)
+    dsu_union_atomic(job->d, job->edges[2 * i], job->edges[2 * i + 1]);
+}
+
+static void report(const char *label, size_t ops, double sec) {
+  printf("%-24s %8.2f Mops/s\n", label, (double)ops / sec * 1e-6);
+}
+
+int main(int argc, char *argv[]) {
+  int32_t n = argc > 1 ? atoi(argv[1]) : 1 << 22;
+  int nthreads = argc > 2 ? atoi(argv[2]) : 0;
+  if (n < 2) {
+    fprintf(stderr, "Usage: %s [n >= 2] [threads]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  size_t m = (size_t)n;
+  int32_t *edges = malloc(2 * m * sizeof(*edges));
+  int32_t *queries = malloc(m * sizeof(*queries));
+  RecDsu rec = {malloc((size_t)n * sizeof(int64_t)),
+                malloc((size_t)n * sizeof(int64_t)), n};
+  if (!edges || !queries || !rec.parent || !rec.size) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0; i < 2 * m; ++i)
+    edges[i] = (int32_t)(rng_next() % (uint64_t)n);
+  for (size_t i = 0; i < m; ++i)
+    queries[i] = (int32_t)(rng_next() % (uint64_t)n);
+  printf("n = %d\n", n);
+
+  for (int32_t i = 0; i < n; ++i) {
+    rec.parent[i] = i;
+    rec.size[i] = 1;
+  }
+  double t0 = perf_now_seconds();
+  for (size_t i = 0; i < m; ++i)
+    rec_union(&rec, edges[2 * i], edges[2 * i + 1]);
+  double t1 = perf_now_seconds();
+  int64_t sink = 0;
+  for (size_t i = 0; i < m; ++i)
+    sink += rec_find(&rec, queries[i]);
+  double t2 = perf_now_seconds();
+  report("recursive union", m, t1 - t0);
+  report("recursive find", m, t2 - t1);
+
+  Dsu d;
+  if (!dsu_init(&d, n)) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+  t0 = perf_now_seconds();
+  for (size_t i = 0; i < m; ++i)
+    dsu_union(&d, edges[2 * i], edges[2 * i + 1]);
+  t1 = perf_now_seconds();
+  for (size_t i = 0; i < m; ++i)
+    sink += dsu_find(&d, queries[i]);
+  t2 = perf_now_seconds();
+  report("dsu_union", m, t1 - t0);
+  report("dsu_find", m, t2 - t1);
+  int32_t sets = dsu_count(&d);
+  dsu_free(&d);
+
+  dsu_init(&d, n);
+  t0 = perf_now_seconds();
+  for (size_t i = 0; i < m; ++i)
+    dsu_union_atomic(&d, edges[2 * i], edges[2 * i + 1]);
+  t1 = perf_now_seconds();
+  report("dsu_union_atomic", m, t1 - t0);
+  int ok = dsu_count(&d) == sets;
+  dsu_free(&d);
+
+  threadpool_t pool;
+  if (threadpool_init(&pool, nthreads) != 0) {
+    fprintf(stderr, "Failed to initialize thread pool\n");
+    return EXIT_FAILURE;
+  }
+  size_t njobs = (m + EDGE_BATCH - 1) / EDGE_BATCH;
+  union_job_t *jobs = malloc(njobs * sizeof(*jobs));
+  dsu_init(&d, n);
+  t0 = perf_now_seconds();
+  for (size_t j = 0; j < njobs; ++j) {
+    size_t begin = j * EDGE_BATCH;
+    size_t len = m - begin < EDGE_BATCH ? m - begin : EDGE_BATCH;
+    jobs[j] = (union_job_t){&d, edges + 2 * begin, len};
+    threadpool_submit(&pool, union_job, &jobs[j]);
+  }
+  threadpool_wait(&pool);
+  t1 = perf_now_seconds();
+  char label[64];
+  snprintf(label, sizeof(label), "dsu_union_atomic x%d", pool.nthreads);
+  report(label, m, t1 - t0);
+  threadpool_destroy(&pool);
+
+  // Same partition as the serial unions, sizes included once recounted
+  dsu_sync_sizes(&d);
+  ok &= dsu_count(&d) == sets;
+  for (size_t i = 0; i < m && ok; ++i)
+    ok &= dsu_size(&d, queries[i]) == rec.size[rec_find(&rec, queries[i])];
+  printf("sets = %d, %s (%lld)\n", sets, ok ? "match" : "MISMATCH",
+         (long long)(sink & 1));
+
+  dsu_free(&d);
+  free(jobs);
+  free(edges);
+  free(queries);
+  free(rec.parent);
+  free(rec.size);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
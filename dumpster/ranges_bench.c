@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../utils/eytzinger.h"
+#include "../utils/perf_measure.h"
+
+/*
+ * Range membership queries of day5 on a set far larger than L2: the binary
+ * search over sorted ranges that day5.c started with, against the Eytzinger
+ * tree of utils/eytzinger.h searched one query at a time and in lanes.
+ *
+ *   ranges_bench [ranges] [queries]
+ *
+ * Disjoint random ranges, uniform random queries over their span, reported
+ * in million queries per second and as a speedup over the binary search.
+ */
+
+typedef struct {
+  uint64_t left;
+  uint64_t right;
+} RangeInclusive;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static inline uint64_t rng_next(void) {
+  uint64_t x = rng_state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return rng_state = x;
+}
+
+static int binary_contains(const RangeInclusive *ranges, size_t len,
+                           uint64_t number) {
+  size_t left = 0;
+  size_t right = len;
+  while (left < right) {
+    const size_t mid = left + (right - left) / 2;
+    const RangeInclusive *r = &ranges[mid];
+    if (number < r->left) {
+      right = mid;
+    } else if (number > r->right) {
+      left = mid + 1;
+    } else {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#define QUERY_BLOCK 4096
+
+static void report(const char *label, size_t ops, double sec, double base) {
+  printf("%-24s %8.2f Mq/s %6.2fx\n", label, (double)ops / sec * 1e-6,
+         base / sec);
+}
+
+int main(int argc, char *argv[]) {
+  long long n_arg = argc > 1 ? atoll(argv[1]) : 1 << 22;
+  long long m_arg = argc > 2 ? atoll(argv[2]) : 1 << 24;
+  if (n_arg < 1 || m_arg < 1) {
+    fprintf(stderr, "Usage: %s [ranges >= 1] [queries >= 1]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  size_t n = (size_t)n_arg, m = (size_t)m_arg;
+
+  RangeInclusive *ranges = malloc(n * sizeof(*ranges));
+  uint64_t *queries = malloc(m * sizeof(*queries));
+  size_t *nodes = malloc(QUERY_BLOCK * sizeof(*nodes));
+  if (!ranges || !queries || !nodes) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+  // Gaps and lengths about the same, so half the queries hit
+  uint64_t at = 0;
+  for (size_t i = 0; i < n; ++i) {
+    at += 1 + rng_next() % 1024;
+    ranges[i].left = at;
+    at += rng_next() % 1024;
+    ranges[i].right = at;
+  }
+  for (size_t i = 0; i < m; ++i)
+    queries[i] = rng_next() % (at + 1);
+  printf("ranges = %zu (%zu MiB), queries = %zu\n", n,
+         n * sizeof(*ranges) >> 20, m);
+
+  double t0 = perf_now_seconds();
+  size_t base_hits = 0;
+  for (size_t i = 0; i < m; ++i)
+    base_hits += (size_t)binary_contains(ranges, n, queries[i]);
+  double base = perf_now_seconds() - t0;
+  report("binary search", m, base, base);
+
+  Eytzinger e;
+  if (!eytzinger_build(&e, &ranges[0].left, 2, &ranges[0].right, 2, n)) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  t0 = perf_now_seconds();
+  size_t hits = 0;
+  for (size_t i = 0; i < m; ++i) {
+    size_t k = eytzinger_find_le(&e, queries[i]);
+    hits += k != 0 && queries[i] <= e.vals[k];
+  }
+  report("eytzinger_find_le", m, perf_now_seconds() - t0, base);
+  int ok = hits == base_hits;
+
+  t0 = perf_now_seconds();
+  hits = 0;
+  for (size_t i = 0; i < m; i += QUERY_BLOCK) {
+    size_t len = m - i < QUERY_BLOCK ? m - i : QUERY_BLOCK;
+    eytzinger_find_le_batch(&e, queries + i, len, nodes);
+    for (size_t j = 0; j < len; ++j)
+      hits += nodes[j] != 0 && queries[i + j] <= e.vals[nodes[j]];
+  }
+  report("eytzinger_find_le_batch", m, perf_now_seconds() - t0, base);
+  ok &= hits == base_hits;
+
+  printf("hits = %zu, %s\n", base_hits, ok ? "match" : "MISMATCH");
+  eytzinger_free(&e);
+  free(ranges);
+  free(queries);
+  free(nodes);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
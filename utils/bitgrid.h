@@ -0,0 +1,280 @@
+#ifndef BITGRID_UTILS_H
+#define BITGRID_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "da.h"
+#include "scan.h"
+
+/*
+ * Bit-packed 2D grid, one bit per cell, bit i of word w is column w*64+i.
+ *
+ * Every row carries a zero word on both sides and the grid carries a zero row
+ * above and below, so neighbor kernels never need bounds checks.
+ */
+typedef struct {
+  uint64_t *bits;
+  size_t rows;
+  size_t cols;
+  size_t words;  /* data words per row */
+  size_t stride; /* words per row including padding */
+} BitGrid;
+
+static inline int bitgrid_init(BitGrid *g, size_t rows, size_t cols) {
+  g->rows = rows;
+  g->cols = cols;
+  g->words = (cols + 63) / 64;
+  g->stride = g->words + 2;
+
+  size_t total = (rows + 2) * g->stride;
+  g->bits = make(uint64_t, total);
+  if (!g->bits) {
+    return 0;
+  }
+  memset(g->bits, 0, total * sizeof(*g->bits));
+  da_set_len(g->bits, total);
+  return 1;
+}
+
+static inline void bitgrid_free(BitGrid *g) {
+  da_free(g->bits);
+  g->bits = NULL;
+}
+
+/* First data word of row y, y == -1 and y == rows are the zero pad rows */
+static inline uint64_t *bitgrid_row(const BitGrid *g, ptrdiff_t y) {
+  return g->bits + (size_t)(y + 1) * g->stride + 1;
+}
+
+static inline void bitgrid_set(BitGrid *g, size_t x, size_t y) {
+  bitgrid_row(g, (ptrdiff_t)y)[x / 64] |= 1ull << (x % 64);
+}
+
+static inline void bitgrid_clear(BitGrid *g, size_t x, size_t y) {
+  bitgrid_row(g, (ptrdiff_t)y)[x / 64] &= ~(1ull << (x % 64));
+}
+
+static inline int bitgrid_get(const BitGrid *g, size_t x, size_t y) {
+  return (int)((bitgrid_row(g, (ptrdiff_t)y)[x / 64] >> (x % 64)) & 1);
+}
+
+/* Sets a bit for every byte equal to `c` in a row-major text grid */
+static inline void bitgrid_from_chars(BitGrid *g, const unsigned char *data,
+                                      size_t data_stride, unsigned char c) {
+  for (size_t y = 0; y < g->rows; ++y) {
+    const unsigned char *src = data + y * data_stride;
+    uint64_t *row = bitgrid_row(g, (ptrdiff_t)y);
+    for (size_t w = 0; w < g->words; ++w) {
+      size_t base = w * 64;
+      size_t n = g->cols - base < 64 ? g->cols - base : 64;
+      if (n == 64) {
+        row[w] = scan_byte64(src + base, c);
+        continue;
+      }
+      uint64_t word = 0;
+      for (size_t i = 0; i < n; ++i) {
+        word |= (uint64_t)(src[base + i] == c) << i;
+      }
+      row[w] = word;
+    }
+  }
+}
+
+/*
+ * Bit-sliced 8-neighbor count: sums the eight shifted neighbor words into
+ * four bit planes (z3 z2 z1 z0) with a carry-save adder network, so 64 cells
+ * (256 or 512 with AVX2 or AVX-512) are counted with a couple dozen logic ops.
+ */
+#define BITGRID__ADDER_NETWORK(T, AND, OR, XOR, aw, a, ae, cw, ce, bw, b, be,  \
+                               z0, z1, z2, z3)                                 \
+  do {                                                                         \
+    T _a0 = XOR(XOR(aw, a), ae);                                               \
+    T _a1 = OR(AND(aw, a), AND(ae, XOR(aw, a)));                               \
+    T _b0 = XOR(XOR(bw, b), be);                                               \
+    T _b1 = OR(AND(bw, b), AND(be, XOR(bw, b)));                               \
+    T _c0 = XOR(cw, ce);                                                       \
+    T _c1 = AND(cw, ce);                                                       \
+    T _k = AND(_a0, _b0);                                                      \
+    T _x0 = XOR(_a0, _b0);                                                     \
+    T _x1 = XOR(XOR(_a1, _b1), _k);                                            \
+    T _x2 = OR(AND(_a1, _b1), AND(_k, XOR(_a1, _b1)));                         \
+    T _k0 = AND(_x0, _c0);                                                     \
+    T _k1 = OR(AND(_x1, _c1), AND(_k0, XOR(_x1, _c1)));                        \
+    (z0) = XOR(_x0, _c0);                                                      \
+    (z1) = XOR(XOR(_x1, _c1), _k0);                                            \
+    (z2) = XOR(_x2, _k1);                                                      \
+    (z3) = AND(_x2, _k1);                                                      \
+  } while (0)
+
+#define BITGRID__AND(x, y) ((x) & (y))
+#define BITGRID__OR(x, y) ((x) | (y))
+#define BITGRID__XOR(x, y) ((x) ^ (y))
+
+static inline void bitgrid__counts_word(const uint64_t *above,
+                                        const uint64_t *cur,
+                                        const uint64_t *below, size_t w,
+                                        uint64_t *z0, uint64_t *z1,
+                                        uint64_t *z2, uint64_t *z3) {
+  uint64_t aw = (above[w] << 1) | (above[w - 1] >> 63);
+  uint64_t ae = (above[w] >> 1) | (above[w + 1] << 63);
+  uint64_t cw = (cur[w] << 1) | (cur[w - 1] >> 63);
+  uint64_t ce = (cur[w] >> 1) | (cur[w + 1] << 63);
+  uint64_t bw = (below[w] << 1) | (below[w - 1] >> 63);
+  uint64_t be = (below[w] >> 1) | (below[w + 1] << 63);
+  BITGRID__ADDER_NETWORK(uint64_t, BITGRID__AND, BITGRID__OR, BITGRID__XOR, aw,
+                         above[w], ae, cw, ce, bw, below[w], be, *z0, *z1, *z2,
+                         *z3);
+}
+
+/*
+ * Neighbor counts for one row as bit planes: cell i of the row has
+ * count = z0_i + 2*z1_i + 4*z2_i + 8*z3_i. Any plane pointer may be NULL.
+ */
+typedef void (*bitgrid_row_counts_fn)(const uint64_t *above,
+                                      const uint64_t *cur,
+                                      const uint64_t *below, size_t words,
+                                      uint64_t *z0, uint64_t *z1, uint64_t *z2,
+                                      uint64_t *z3);
+
+/* Words [w, words) one at a time, the tail of the vector variants */
+static inline void bitgrid__row_counts_from(const uint64_t *above,
+                                            const uint64_t *cur,
+                                            const uint64_t *below, size_t w,
+                                            size_t words, uint64_t *z0,
+                                            uint64_t *z1, uint64_t *z2,
+                                            uint64_t *z3) {
+  for (; w < words; ++w) {
+    uint64_t p0, p1, p2, p3;
+    bitgrid__counts_word(above, cur, below, w, &p0, &p1, &p2, &p3);
+    if (z0)
+      z0[w] = p0;
+    if (z1)
+      z1[w] = p1;
+    if (z2)
+      z2[w] = p2;
+    if (z3)
+      z3[w] = p3;
+  }
+}
+
+static void bitgrid__row_counts_scalar(const uint64_t *above,
+                                       const uint64_t *cur,
+                                       const uint64_t *below, size_t words,
+                                       uint64_t *z0, uint64_t *z1,
+                                       uint64_t *z2, uint64_t *z3) {
+  bitgrid__row_counts_from(above, cur, below, 0, words, z0, z1, z2, z3);
+}
+
+#if CPU_X86
+
+/* Neighbor words shifted by one column, carrying across word boundaries */
+#define BITGRID__WEST(W, LOAD, SLL, SRL, OR, row, w)                           \
+  OR(SLL(LOAD((const W *)((row) + (w))), 1),                                   \
+     SRL(LOAD((const W *)((row) + (w) - 1)), 63))
+#define BITGRID__EAST(W, LOAD, SLL, SRL, OR, row, w)                           \
+  OR(SRL(LOAD((const W *)((row) + (w))), 1),                                   \
+     SLL(LOAD((const W *)((row) + (w) + 1)), 63))
+
+#define BITGRID__W256(row)                                                     \
+  BITGRID__WEST(__m256i, _mm256_loadu_si256, _mm256_slli_epi64,                \
+                _mm256_srli_epi64, _mm256_or_si256, row, w)
+#define BITGRID__E256(row)                                                     \
+  BITGRID__EAST(__m256i, _mm256_loadu_si256, _mm256_slli_epi64,                \
+                _mm256_srli_epi64, _mm256_or_si256, row, w)
+#define BITGRID__W512(row)                                                     \
+  BITGRID__WEST(void, _mm512_loadu_si512, _mm512_slli_epi64,                   \
+                _mm512_srli_epi64, _mm512_or_si512, row, w)
+#define BITGRID__E512(row)                                                     \
+  BITGRID__EAST(void, _mm512_loadu_si512, _mm512_slli_epi64,                   \
+                _mm512_srli_epi64, _mm512_or_si512, row, w)
+
+CPU_TARGET_AVX2 static void
+bitgrid__row_counts_avx2(const uint64_t *above, const uint64_t *cur,
+                         const uint64_t *below, size_t words, uint64_t *z0,
+                         uint64_t *z1, uint64_t *z2, uint64_t *z3) {
+  size_t w = 0;
+  for (; w + 4 <= words; w += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(above + w));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(below + w));
+    __m256i aw = BITGRID__W256(above), ae = BITGRID__E256(above);
+    __m256i cw = BITGRID__W256(cur), ce = BITGRID__E256(cur);
+    __m256i bw = BITGRID__W256(below), be = BITGRID__E256(below);
+    __m256i p0, p1, p2, p3;
+    BITGRID__ADDER_NETWORK(__m256i, _mm256_and_si256, _mm256_or_si256,
+                           _mm256_xor_si256, aw, a, ae, cw, ce, bw, b, be, p0,
+                           p1, p2, p3);
+    if (z0)
+      _mm256_storeu_si256((__m256i *)(z0 + w), p0);
+    if (z1)
+      _mm256_storeu_si256((__m256i *)(z1 + w), p1);
+    if (z2)
+      _mm256_storeu_si256((__m256i *)(z2 + w), p2);
+    if (z3)
+      _mm256_storeu_si256((__m256i *)(z3 + w), p3);
+  }
+  bitgrid__row_counts_from(above, cur, below, w, words, z0, z1, z2, z3);
+}
+
+CPU_TARGET_AVX512 static void
+bitgrid__row_counts_avx512(const uint64_t *above, const uint64_t *cur,
+                           const uint64_t *below, size_t words, uint64_t *z0,
+                           uint64_t *z1, uint64_t *z2, uint64_t *z3) {
+  size_t w = 0;
+  for (; w + 8 <= words; w += 8) {
+    __m512i a = _mm512_loadu_si512((const void *)(above + w));
+    __m512i b = _mm512_loadu_si512((const void *)(below + w));
+    __m512i aw = BITGRID__W512(above), ae = BITGRID__E512(above);
+    __m512i cw = BITGRID__W512(cur), ce = BITGRID__E512(cur);
+    __m512i bw = BITGRID__W512(below), be = BITGRID__E512(below);
+    __m512i p0, p1, p2, p3;
+    BITGRID__ADDER_NETWORK(__m512i, _mm512_and_si512, _mm512_or_si512,
+                           _mm512_xor_si512, aw, a, ae, cw, ce, bw, b, be, p0,
+                           p1, p2, p3);
+    if (z0)
+      _mm512_storeu_si512((void *)(z0 + w), p0);
+    if (z1)
+      _mm512_storeu_si512((void *)(z1 + w), p1);
+    if (z2)
+      _mm512_storeu_si512((void *)(z2 + w), p2);
+    if (z3)
+      _mm512_storeu_si512((void *)(z3 + w), p3);
+  }
+  bitgrid__row_counts_from(above, cur, below, w, words, z0, z1, z2, z3);
+}
+
+#undef BITGRID__W256
+#undef BITGRID__E256
+#undef BITGRID__W512
+#undef BITGRID__E512
+
+#endif /* CPU_X86 */
+
+static inline bitgrid_row_counts_fn bitgrid__resolve_row_counts(int level) {
+#if CPU_X86
+  if (level >= CPU_AVX512)
+    return bitgrid__row_counts_avx512;
+  if (level >= CPU_AVX2)
+    return bitgrid__row_counts_avx2;
+#endif
+  (void)level;
+  return bitgrid__row_counts_scalar;
+}
+
+static inline void bitgrid_row_counts(const uint64_t *above,
+                                      const uint64_t *cur,
+                                      const uint64_t *below, size_t words,
+                                      uint64_t *z0, uint64_t *z1, uint64_t *z2,
+                                      uint64_t *z3) {
+  static _Atomic(bitgrid_row_counts_fn) fn;
+  bitgrid_row_counts_fn f = atomic_load_explicit(&fn, memory_order_relaxed);
+  if (!f) {
+    f = bitgrid__resolve_row_counts(cpu_level());
+    atomic_store_explicit(&fn, f, memory_order_relaxed);
+  }
+  f(above, cur, below, words, z0, z1, z2, z3);
+}
+
+#endif /* BITGRID_UTILS_H */
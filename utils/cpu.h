@@ -0,0 +1,104 @@
+#ifndef CPU_UTILS_H
+#define CPU_UTILS_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Runtime CPU feature dispatch.
+ *
+ * Kernels are built for several instruction sets in the same binary, the
+ * wider variants through the `target` attribute, so no -m flags are needed.
+ * cpu_level() probes cpuid once and every dispatching kernel binds its
+ * function pointer on first use. AOC_CPU=scalar|sse2|avx2|avx512 caps the
+ * level, so each path can be forced and tested on a wider machine.
+ */
+enum {
+  CPU_SCALAR = 0,
+  CPU_SSE2 = 1,
+  CPU_AVX2 = 2,
+  CPU_AVX512 = 3, /* F + BW */
+};
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define CPU_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#define CPU_TARGET_SSE2 __attribute__((target("sse2")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define CPU_X86 0
+#endif
+
+static const char *const cpu__names[] = {"scalar", "sse2", "avx2", "avx512"};
+
+static inline const char *cpu_level_name(int level) {
+  return cpu__names[level];
+}
+
+#if CPU_X86
+static inline unsigned long long cpu__xgetbv(void) {
+  unsigned eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+}
+#endif
+
+static inline int cpu__detect(void) {
+#if CPU_X86
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return CPU_SCALAR;
+  int level = (edx & bit_SSE2) ? CPU_SSE2 : CPU_SCALAR;
+
+  /* The OS has to save the wide registers too, not only the CPU have them */
+  if (!(ecx & bit_OSXSAVE) || __get_cpuid_max(0, NULL) < 7)
+    return level;
+  unsigned long long xcr0 = cpu__xgetbv();
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  if ((xcr0 & 0x6) == 0x6 && (ebx & bit_AVX2))
+    level = CPU_AVX2;
+  if (level == CPU_AVX2 && (xcr0 & 0xE0) == 0xE0 && (ebx & bit_AVX512F) &&
+      (ebx & bit_AVX512BW))
+    level = CPU_AVX512;
+  return level;
+#else
+  return CPU_SCALAR;
+#endif
+}
+
+/* Best usable level, capped by AOC_CPU */
+static inline int cpu_level(void) {
+  static _Atomic int cached = -1;
+  int level = atomic_load_explicit(&cached, memory_order_relaxed);
+  if (level >= 0)
+    return level;
+
+  level = cpu__detect();
+  const char *env = getenv("AOC_CPU");
+  if (env) {
+    int want = -1;
+    for (int i = CPU_SCALAR; i <= CPU_AVX512; ++i) {
+      if (strcmp(env, cpu__names[i]) == 0)
+        want = i;
+    }
+    if (want < 0) {
+      fprintf(stderr, "AOC_CPU=%s is not one of scalar|sse2|avx2|avx512\n",
+              env);
+    } else if (want > level) {
+      fprintf(stderr, "AOC_CPU=%s is not supported here, using %s\n", env,
+              cpu__names[level]);
+    } else {
+      level = want;
+    }
+  }
+  /* Racing threads compute the same value */
+  atomic_store_explicit(&cached, level, memory_order_relaxed);
+  return level;
+}
+
+#endif /* CPU_UTILS_H */
@@ -0,0 +1,73 @@
+#ifndef CSR_UTILS_H
+#define CSR_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "da.h"
+
+/*
+ * Jagged table in compressed sparse row form: every row is stored back to
+ * back in one values array, row i is values[offsets[i] .. offsets[i + 1]).
+ *
+ * Rows are built in order with csr_push/csr_end_row.
+ */
+typedef struct {
+  uint64_t *values;
+  size_t *offsets; /* rows + 1 entries */
+} Csr;
+
+static inline int csr_init(Csr *c, size_t values_cap) {
+  c->values = make(uint64_t, values_cap ? values_cap : 16);
+  c->offsets = make(size_t, 16);
+  if (!c->values || !c->offsets) {
+    da_free(c->values);
+    da_free(c->offsets);
+    return 0;
+  }
+  append(c->offsets, 0);
+  return 1;
+}
+
+/* Room for values_cap values in total, 0 when out of memory */
+static inline int csr_reserve(Csr *c, size_t values_cap) {
+  uint64_t *values = da_reserve(c->values, sizeof(*values), values_cap);
+  if (!values)
+    return 0;
+  c->values = values;
+  return 1;
+}
+
+static inline void csr_free(Csr *c) {
+  da_free(c->values);
+  da_free(c->offsets);
+  c->values = NULL;
+  c->offsets = NULL;
+}
+
+/* Closed rows, values pushed after the last csr_end_row are not counted */
+static inline size_t csr_rows(const Csr *c) { return da_len(c->offsets) - 1; }
+
+static inline size_t csr_len(const Csr *c) { return da_len(c->values); }
+
+static inline uint64_t *csr_row(const Csr *c, size_t row) {
+  return c->values + c->offsets[row];
+}
+
+static inline size_t csr_row_len(const Csr *c, size_t row) {
+  return c->offsets[row + 1] - c->offsets[row];
+}
+
+/* Appends to the row currently being built */
+static inline void csr_push(Csr *c, uint64_t value) { append(c->values, value); }
+
+static inline void csr_end_row(Csr *c) {
+  append(c->offsets, da_len(c->values));
+}
+
+#define csr_foreach(it, c, row)                                                \
+  for (uint64_t *it = csr_row((c), (row)),                                     \
+                *_end = it + csr_row_len((c), (row));                          \
+       it < _end; ++it)
+
+#endif /* CSR_UTILS_H */
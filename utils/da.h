@@ -115,6 +115,20 @@ static inline size_t da_len(const void *da) { return da ? da__hdr(da)->len : 0;
 
 static inline size_t da_cap(const void *da) { return da ? da__hdr(da)->cap : 0; }
 
+/* Sets the length within the capacity, new elements are left as they are.
+ * Returns 0 and leaves da alone when len is past the capacity. */
+static inline int da_set_len(void *da, size_t len) {
+  if (len > da_cap(da)) {
+    return 0;
+  }
+  if (da) {
+    da__hdr(da)->len = len;
+  }
+  return 1;
+}
+
+static inline void da_clear(void *da) { da_set_len(da, 0); }
+
 static inline void da_free(void *da) {
   if (da) {
     free((unsigned char *)da - DAH_OFFSET);
@@ -134,6 +148,9 @@ static inline void da_free(void *da) {
     (da) = _da;                                                                \
   } while (0)
 
+/* Removes and yields the last element, da must not be empty */
+#define da_pop(da) ((da)[--da__hdr(da)->len])
+
 #define foreach(it, da)                                                        \
   for (typeof(da) _da = (da), it = _da; _da && it < _da + da_len(_da); ++it)
 
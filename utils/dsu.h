@@ -0,0 +1,159 @@
+#ifndef DSU_UTILS_H
+#define DSU_UTILS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Disjoint set union over 0..n-1 in two int32 arrays.
+ *
+ * Finds are iterative with path halving: every visited node is pointed at
+ * its grandparent, which flattens the tree as well as full compression does
+ * without a second pass or recursion.
+ *
+ * dsu_union links by size and is for one thread. dsu_union_atomic may run
+ * from many threads at once: it links a root with a single CAS on its parent
+ * slot and halves paths with CAS too. Concurrent links cannot go by size, a
+ * size read is stale as soon as another thread links, so roots are ordered
+ * by a fixed pseudo random priority instead. Parents always have a higher
+ * priority than their children, which rules out cycles and keeps the
+ * expected depth logarithmic. Set sizes are not kept up to date by the
+ * atomic unions, dsu_sync_sizes recounts them after a concurrent phase.
+ *
+ * The parent slots are atomics accessed with relaxed ordering, which are
+ * plain loads and stores on the serial path.
+ */
+typedef struct {
+  _Atomic int32_t *parent;
+  int32_t *size;
+  int32_t n;
+  _Atomic int32_t count; /* number of sets */
+} Dsu;
+
+static inline int dsu_init(Dsu *d, int32_t n) {
+  size_t cap = n > 0 ? (size_t)n : 1;
+  d->parent = malloc(cap * sizeof(*d->parent));
+  d->size = malloc(cap * sizeof(*d->size));
+  if (!d->parent || !d->size) {
+    free(d->parent);
+    free(d->size);
+    d->parent = NULL;
+    d->size = NULL;
+    return 0;
+  }
+  for (int32_t i = 0; i < n; ++i) {
+    atomic_init(&d->parent[i], i);
+    d->size[i] = 1;
+  }
+  d->n = n;
+  atomic_init(&d->count, n);
+  return 1;
+}
+
+static inline void dsu_free(Dsu *d) {
+  free(d->parent);
+  free(d->size);
+  d->parent = NULL;
+  d->size = NULL;
+  d->n = 0;
+}
+
+static inline int32_t dsu_count(const Dsu *d) {
+  return atomic_load_explicit(&d->count, memory_order_relaxed);
+}
+
+static inline int32_t dsu__parent(const Dsu *d, int32_t x) {
+  return atomic_load_explicit(&d->parent[x], memory_order_relaxed);
+}
+
+static inline int32_t dsu_find(Dsu *d, int32_t x) {
+  int32_t p;
+  while ((p = dsu__parent(d, x)) != x) {
+    int32_t g = dsu__parent(d, p);
+    atomic_store_explicit(&d->parent[x], g, memory_order_relaxed);
+    x = g;
+  }
+  return x;
+}
+
+static inline int32_t dsu_size(Dsu *d, int32_t x) {
+  return d->size[dsu_find(d, x)];
+}
+
+static inline int dsu_same(Dsu *d, int32_t a, int32_t b) {
+  return dsu_find(d, a) == dsu_find(d, b);
+}
+
+/* Returns 1 when a and b were in different sets */
+static inline int dsu_union(Dsu *d, int32_t a, int32_t b) {
+  a = dsu_find(d, a);
+  b = dsu_find(d, b);
+  if (a == b)
+    return 0;
+  if (d->size[a] < d->size[b]) {
+    int32_t t = a;
+    a = b;
+    b = t;
+  }
+  atomic_store_explicit(&d->parent[b], a, memory_order_relaxed);
+  d->size[a] += d->size[b];
+  atomic_store_explicit(&d->count, dsu_count(d) - 1, memory_order_relaxed);
+  return 1;
+}
+
+/* Multiplying by an odd constant is a bijection, so no two nodes tie */
+static inline uint32_t dsu__prio(int32_t x) {
+  return (uint32_t)x * 0x9E3779B1u;
+}
+
+/* Safe alongside other atomic finds and unions, a lost halving CAS is fine */
+static inline int32_t dsu_find_atomic(Dsu *d, int32_t x) {
+  int32_t p;
+  while ((p = dsu__parent(d, x)) != x) {
+    int32_t g = dsu__parent(d, p);
+    if (g != p)
+      atomic_compare_exchange_weak_explicit(&d->parent[x], &p, g,
+                                            memory_order_relaxed,
+                                            memory_order_relaxed);
+    x = g;
+  }
+  return x;
+}
+
+/*
+ * Links the lower priority root under the other one. The CAS only succeeds
+ * while a is still a root, and a cannot be an ancestor of b since priorities
+ * grow towards the root, so a success always joins two different sets.
+ */
+static inline int dsu_union_atomic(Dsu *d, int32_t a, int32_t b) {
+  for (;;) {
+    a = dsu_find_atomic(d, a);
+    b = dsu_find_atomic(d, b);
+    if (a == b)
+      return 0;
+    if (dsu__prio(a) > dsu__prio(b)) {
+      int32_t t = a;
+      a = b;
+      b = t;
+    }
+    int32_t expected = a;
+    if (atomic_compare_exchange_strong_explicit(&d->parent[a], &expected, b,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+      atomic_fetch_sub_explicit(&d->count, 1, memory_order_relaxed);
+      return 1;
+    }
+  }
+}
+
+/* Recounts set sizes once no atomic unions are running */
+static inline void dsu_sync_sizes(Dsu *d) {
+  for (int32_t i = 0; i < d->n; ++i)
+    d->size[i] = 0;
+  for (int32_t i = 0; i < d->n; ++i)
+    d->size[dsu_find(d, i)]++;
+}
+
+#endif /* DSU_UTILS_H */
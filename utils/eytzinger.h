@@ -0,0 +1,142 @@
+#ifndef EYTZINGER_UTILS_H
+#define EYTZINGER_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/*
+ * Static search tree over sorted uint64 keys in Eytzinger (BFS) order.
+ *
+ * Node k has children 2k and 2k+1, so the top levels share a few cache lines
+ * and a descent touches memory in a predictable pattern that can be
+ * prefetched several levels ahead. Every key carries one uint64 value, kept
+ * in a separate array so the search only pulls keys into cache.
+ */
+typedef struct {
+  uint64_t *keys; /* 1-based, cache line aligned */
+  uint64_t *vals; /* 1-based */
+  size_t n;
+} Eytzinger;
+
+#define EYTZINGER_LINE 64
+
+static inline void *eytzinger__alloc(size_t size) {
+  size = (size + EYTZINGER_LINE - 1) / EYTZINGER_LINE * EYTZINGER_LINE;
+#ifdef _WIN32
+  return _aligned_malloc(size, EYTZINGER_LINE);
+#else
+  return aligned_alloc(EYTZINGER_LINE, size);
+#endif
+}
+
+static inline void eytzinger__free(void *p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+static inline void eytzinger_free(Eytzinger *e) {
+  eytzinger__free(e->keys);
+  eytzinger__free(e->vals);
+  e->keys = e->vals = NULL;
+  e->n = 0;
+}
+
+/* In-order walk of the implicit tree assigns sorted elements to nodes */
+static inline size_t eytzinger__fill(Eytzinger *e, const uint64_t *keys,
+                                     size_t key_stride, const uint64_t *vals,
+                                     size_t val_stride, size_t i, size_t k) {
+  if (k <= e->n) {
+    i = eytzinger__fill(e, keys, key_stride, vals, val_stride, i, 2 * k);
+    e->keys[k] = keys[i * key_stride];
+    e->vals[k] = vals[i * val_stride];
+    i = eytzinger__fill(e, keys, key_stride, vals, val_stride, i + 1,
+                        2 * k + 1);
+  }
+  return i;
+}
+
+/*
+ * Builds the tree from n sorted keys and their values. Strides are in
+ * elements, so fields of an array of structs can be passed directly.
+ */
+static inline int eytzinger_build(Eytzinger *e, const uint64_t *keys,
+                                  size_t key_stride, const uint64_t *vals,
+                                  size_t val_stride, size_t n) {
+  e->n = n;
+  size_t size = (n + 1) * sizeof(uint64_t);
+  e->keys = (uint64_t *)eytzinger__alloc(size);
+  e->vals = (uint64_t *)eytzinger__alloc(size);
+  if (!e->keys || !e->vals) {
+    eytzinger_free(e);
+    return 0;
+  }
+  e->keys[0] = e->vals[0] = 0;
+  eytzinger__fill(e, keys, key_stride, vals, val_stride, 0, 1);
+  return 1;
+}
+
+/* Node holding the largest key <= x, 0 when every key is greater */
+static inline size_t eytzinger_find_le(const Eytzinger *e, uint64_t x) {
+  const uint64_t *keys = e->keys;
+  size_t k = 1;
+  while (k <= e->n) {
+    /* Nodes 8k..8k+7, three levels down, share one line. The address may
+     * be past the last node, prefetches never fault. */
+    __builtin_prefetch((const void *)((uintptr_t)keys + k * EYTZINGER_LINE));
+    k = 2 * k + (keys[k] <= x);
+  }
+  /* Trailing zeros are left turns, drop them and the last right turn */
+  return k >> (__builtin_ctzll(k) + 1);
+}
+
+#ifndef EYTZINGER_LANES
+#define EYTZINGER_LANES 16
+#endif
+
+/*
+ * eytzinger_find_le for a block of queries. Lanes of EYTZINGER_LANES queries
+ * descend in lockstep, so their cache misses overlap instead of forming one
+ * dependent chain per query.
+ */
+static inline void eytzinger_find_le_batch(const Eytzinger *e,
+                                           const uint64_t *xs, size_t n,
+                                           size_t *out) {
+  const uint64_t *keys = e->keys;
+  /* Levels that are complete, every lane can take them unconditionally */
+  int full = 0;
+  while (((size_t)2 << full) - 1 <= e->n)
+    full++;
+
+  size_t i = 0;
+  for (; i + EYTZINGER_LANES <= n; i += EYTZINGER_LANES) {
+    size_t k[EYTZINGER_LANES];
+    for (int l = 0; l < EYTZINGER_LANES; ++l)
+      k[l] = 1;
+    for (int level = 0; level < full; ++level) {
+      for (int l = 0; l < EYTZINGER_LANES; ++l) {
+        __builtin_prefetch(
+            (const void *)((uintptr_t)keys + k[l] * EYTZINGER_LINE));
+        k[l] = 2 * k[l] + (keys[k[l]] <= xs[i + (size_t)l]);
+      }
+    }
+    for (int l = 0; l < EYTZINGER_LANES; ++l) {
+      if (k[l] <= e->n)
+        k[l] = 2 * k[l] + (keys[k[l]] <= xs[i + (size_t)l]);
+      out[i + (size_t)l] = k[l] >> (__builtin_ctzll(k[l]) + 1);
+    }
+  }
+
+  for (; i < n; ++i) {
+    out[i] = eytzinger_find_le(e, xs[i]);
+  }
+}
+
+#endif /* EYTZINGER_UTILS_H */
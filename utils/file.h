@@ -14,6 +14,7 @@
 #ifdef _WIN32
 #include <io.h>
 #include <share.h>
+#include <windows.h>
 
 #ifndef O_BINARY
 #define O_BINARY _O_BINARY
@@ -39,6 +40,7 @@ static inline int fu_open_compat(const char *path, int oflag) {
 
 #else /* non-Windows */
 
+#include <sys/mman.h>
 #include <unistd.h>
 
 #define FU_OPEN open
@@ -108,4 +110,96 @@ static inline int read_entire_file(const char *path, unsigned char **out_buf) {
   return ok;
 }
 
+/* Read-only mapping of a whole file, pages are loaded on first touch */
+typedef struct {
+  unsigned char *data;
+  size_t len;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#endif
+} MappedFile;
+
+static inline int map_entire_file(const char *path, MappedFile *m) {
+  if (!path || !m) {
+    return 0;
+  }
+  m->data = NULL;
+  m->len = 0;
+
+#ifdef _WIN32
+
+  m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (m->file == INVALID_HANDLE_VALUE) {
+    return 0;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(m->file, &size) || size.QuadPart == 0) {
+    CloseHandle(m->file);
+    return 0;
+  }
+
+  m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!m->mapping) {
+    CloseHandle(m->file);
+    return 0;
+  }
+
+  m->data = (unsigned char *)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!m->data) {
+    CloseHandle(m->mapping);
+    CloseHandle(m->file);
+    return 0;
+  }
+  m->len = (size_t)size.QuadPart;
+  return 1;
+
+#else /* !_WIN32 */
+
+  int fd;
+  int ok = 1;
+
+  DeferLoop(fd = FU_OPEN(path, FU_FLAGS), FU_CLOSE(fd)) {
+    if (fd < 0) {
+      return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      ok = 0;
+      continue;
+    }
+
+    /* The mapping stays valid after the descriptor is closed */
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ok = 0;
+      continue;
+    }
+    m->data = (unsigned char *)p;
+    m->len = (size_t)st.st_size;
+  }
+
+  return ok;
+
+#endif /* _WIN32 */
+}
+
+static inline void unmap_file(MappedFile *m) {
+  if (!m || !m->data) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(m->data);
+  CloseHandle(m->mapping);
+  CloseHandle(m->file);
+#else
+  munmap(m->data, m->len);
+#endif
+  m->data = NULL;
+  m->len = 0;
+}
+
 #endif /* FILE_UTILS_H */
@@ -0,0 +1,206 @@
+#ifndef INTERVALS_UTILS_H
+#define INTERVALS_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "da.h"
+
+/*
+ * Mutable set of disjoint inclusive uint64 intervals.
+ *
+ * Intervals live in a treap keyed on their left endpoint. Inserting splits
+ * out every interval that overlaps or touches the new one and replaces them
+ * with a single node, so the tree only ever holds disjoint, non-adjacent
+ * intervals. Split and merge are expected O(log n). Each interval is removed
+ * at most once after it was inserted, so the coalescing is amortized O(1).
+ * The covered length is kept as a running total.
+ *
+ * Nodes are stored in a dynamic array and addressed by index, 0 is the empty
+ * tree. Freed nodes are chained through their left child for reuse.
+ */
+typedef struct {
+  uint64_t left;
+  uint64_t right;
+  uint64_t prio;
+  uint32_t l; /* children */
+  uint32_t r;
+} IntervalNode;
+
+typedef struct {
+  IntervalNode *nodes;
+  uint32_t root;
+  uint32_t free;
+  size_t count;
+  uint64_t covered; /* sum of lengths, wraps if the full u64 range is set */
+  uint64_t seed;
+} IntervalSet;
+
+static inline int intervals_init(IntervalSet *s) {
+  IntervalNode nil = {0};
+  s->nodes = make(IntervalNode, 64);
+  if (!s->nodes)
+    return 0;
+  append(s->nodes, nil);
+  s->root = s->free = 0;
+  s->count = 0;
+  s->covered = 0;
+  s->seed = 0x9E3779B97F4A7C15ull;
+  return 1;
+}
+
+static inline void intervals_free(IntervalSet *s) {
+  da_free(s->nodes);
+  s->nodes = NULL;
+  s->root = s->free = 0;
+  s->count = 0;
+  s->covered = 0;
+}
+
+static inline size_t intervals_count(const IntervalSet *s) { return s->count; }
+
+static inline uint64_t intervals_covered(const IntervalSet *s) {
+  return s->covered;
+}
+
+/* splitmix64, priorities only need to look random */
+static inline uint64_t intervals__prio(IntervalSet *s) {
+  uint64_t z = (s->seed += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static inline uint32_t intervals__alloc(IntervalSet *s, uint64_t left,
+                                        uint64_t right) {
+  IntervalNode node = {left, right, intervals__prio(s), 0, 0};
+  uint32_t i = s->free;
+  if (i) {
+    s->free = s->nodes[i].l;
+    s->nodes[i] = node;
+    return i;
+  }
+  if (da_len(s->nodes) > UINT32_MAX)
+    return 0;
+  size_t len = da_len(s->nodes);
+  append(s->nodes, node);
+  if (!s->nodes || da_len(s->nodes) == len)
+    return 0;
+  return (uint32_t)len;
+}
+
+/*
+ * Splits t into a (left endpoints before key) and b (the rest). With
+ * `inclusive` a left endpoint equal to key goes to a.
+ */
+static inline void intervals__split(IntervalNode *nodes, uint32_t t,
+                                    uint64_t key, int inclusive, uint32_t *a,
+                                    uint32_t *b) {
+  if (!t) {
+    *a = *b = 0;
+    return;
+  }
+  IntervalNode *n = &nodes[t];
+  if (n->left < key || (inclusive && n->left == key)) {
+    intervals__split(nodes, n->r, key, inclusive, &n->r, b);
+    *a = t;
+  } else {
+    intervals__split(nodes, n->l, key, inclusive, a, &n->l);
+    *b = t;
+  }
+}
+
+/* Every key of a precedes every key of b */
+static inline uint32_t intervals__merge(IntervalNode *nodes, uint32_t a,
+                                       uint32_t b) {
+  if (!a || !b)
+    return a ? a : b;
+  if (nodes[a].prio > nodes[b].prio) {
+    nodes[a].r = intervals__merge(nodes, nodes[a].r, b);
+    return a;
+  }
+  nodes[b].l = intervals__merge(nodes, a, nodes[b].l);
+  return b;
+}
+
+/* Removes a whole subtree, returns the largest right endpoint in it */
+static inline uint64_t intervals__release(IntervalSet *s, uint32_t t) {
+  uint64_t right = 0;
+  while (t) {
+    IntervalNode *n = &s->nodes[t];
+    uint64_t r = intervals__release(s, n->r);
+    if (r > right)
+      right = r;
+    if (n->right > right)
+      right = n->right;
+    s->covered -= n->right - n->left + 1;
+    s->count--;
+    uint32_t next = n->l;
+    n->l = s->free;
+    s->free = t;
+    t = next;
+  }
+  return right;
+}
+
+/* Node with the largest left endpoint <= x, 0 if none */
+static inline uint32_t intervals__find_le(const IntervalSet *s, uint64_t x) {
+  uint32_t t = s->root, found = 0;
+  while (t) {
+    const IntervalNode *n = &s->nodes[t];
+    if (n->left <= x) {
+      found = t;
+      t = n->r;
+    } else {
+      t = n->l;
+    }
+  }
+  return found;
+}
+
+static inline int intervals_contains(const IntervalSet *s, uint64_t x) {
+  uint32_t t = intervals__find_le(s, x);
+  return t && x <= s->nodes[t].right;
+}
+
+/* Adds [left, right] and coalesces, returns 0 when out of memory */
+static inline int intervals_insert(IntervalSet *s, uint64_t left,
+                                   uint64_t right) {
+  if (left > right)
+    return 1;
+
+  uint32_t p = intervals__find_le(s, left);
+  if (p) {
+    const IntervalNode *n = &s->nodes[p];
+    if (n->right >= right)
+      return 1; /* already covered */
+    if (n->right + 1 >= left)
+      left = n->left;
+  }
+
+  uint32_t node = intervals__alloc(s, left, right);
+  if (!node)
+    return 0;
+
+  /* before: ends before left, touching: starts within [left, right + 1] */
+  uint32_t before, rest, touching, after;
+  intervals__split(s->nodes, s->root, left, 0, &before, &rest);
+  if (right == UINT64_MAX) {
+    touching = rest;
+    after = 0;
+  } else {
+    intervals__split(s->nodes, rest, right + 1, 1, &touching, &after);
+  }
+
+  uint64_t end = intervals__release(s, touching);
+  if (end > right)
+    s->nodes[node].right = right = end;
+
+  s->covered += right - left + 1;
+  s->count++;
+  s->root = intervals__merge(
+      s->nodes, intervals__merge(s->nodes, before, node), after);
+  return 1;
+}
+
+#endif /* INTERVALS_UTILS_H */
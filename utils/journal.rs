@@ -0,0 +1,194 @@
+//! Append-only checkpoint journal for long running solvers.
+//!
+//! Every record is framed as
+//!
+//!   [len: u32 LE][crc32(payload): u32 LE][payload: len bytes]
+//!
+//! so a record cut short by a crash, or one whose bytes never made it to
+//! disk, is told apart from a whole one. Opening a journal replays the
+//! records up to the first bad frame and cuts the file there, the records
+//! after a torn tail are lost but the ones before it are kept.
+//!
+//! The first record is a header naming what the records belong to, such as
+//! the input they were computed from. A journal that starts with another
+//! header was left by a different run and is emptied on open.
+//!
+//! Workers hand records to a channel and never touch the file. A single
+//! writer thread drains whatever is queued into one write and syncs the file
+//! at most once per `sync_every` (group commit), a zero interval syncs after
+//! every batch. Dropping or closing the journal writes and syncs the rest.
+//! The writer stops on the first error, appends fail from then on so a long
+//! run can stop instead of going on without checkpoints.
+
+use std::{
+    fs::OpenOptions,
+    io::{self, BufWriter, Read, Write},
+    path::Path,
+    sync::mpsc::{self, RecvTimeoutError, Sender},
+    thread::{self, JoinHandle},
+    time::{Duration, Instant},
+};
+
+const HEADER: usize = 8;
+
+pub struct Journal {
+    tx: Option<Sender<Vec<u8>>>,
+    writer: Option<JoinHandle<io::Result<()>>>,
+}
+
+impl Journal {
+    /// Opens or creates the journal at `path` for `header` and returns it
+    /// along with the payloads of the records already in it, oldest first.
+    /// The records of a journal written for another header are dropped.
+    pub fn open(
+        path: impl AsRef<Path>,
+        header: &[u8],
+        sync_every: Duration,
+    ) -> io::Result<(Self, Vec<Vec<u8>>)> {
+        let mut file = OpenOptions::new()
+            .read(true)
+            .create(true)
+            .append(true)
+            .open(path)?;
+        let mut buf = Vec::new();
+        file.read_to_end(&mut buf)?;
+        let (mut records, valid) = replay(&buf);
+        if records.first().is_some_and(|first| first == header) {
+            records.remove(0);
+            if valid < buf.len() {
+                file.set_len(valid as u64)?;
+                file.sync_data()?;
+            }
+        } else {
+            records.clear();
+            file.set_len(0)?;
+            write_record(&mut file, header)?;
+            file.sync_data()?;
+        }
+
+        let (tx, rx) = mpsc::channel::<Vec<u8>>();
+        let writer = thread::spawn(move || -> io::Result<()> {
+            let mut out = BufWriter::new(file);
+            let mut synced = Instant::now();
+            let mut dirty = false;
+            loop {
+                let next = if dirty {
+                    rx.recv_timeout(sync_every.saturating_sub(synced.elapsed()))
+                } else {
+                    // Nothing to sync, wait for the next record however long
+                    rx.recv().map_err(|_| RecvTimeoutError::Disconnected)
+                };
+                match next {
+                    Ok(record) => {
+                        write_record(&mut out, &record)?;
+                        for record in rx.try_iter() {
+                            write_record(&mut out, &record)?;
+                        }
+                        out.flush()?;
+                        dirty = true;
+                    }
+                    Err(RecvTimeoutError::Timeout) => {}
+                    Err(RecvTimeoutError::Disconnected) => break,
+                }
+                if dirty && synced.elapsed() >= sync_every {
+                    out.get_ref().sync_data()?;
+                    synced = Instant::now();
+                    dirty = false;
+                }
+            }
+            out.flush()?;
+            out.get_ref().sync_data()
+        });
+
+        let journal = Journal {
+            tx: Some(tx),
+            writer: Some(writer),
+        };
+        Ok((journal, records))
+    }
+
+    /// Queues a record, the write happens on the writer thread. Fails once
+    /// the writer has stopped on an error, close reports which.
+    pub fn append(&self, record: Vec<u8>) -> io::Result<()> {
+        let stopped = || io::Error::other("journal writer stopped");
+        let tx = self.tx.as_ref().ok_or_else(stopped)?;
+        tx.send(record).map_err(|_| stopped())
+    }
+
+    /// Writes and syncs everything queued so far and stops the writer
+    pub fn close(mut self) -> io::Result<()> {
+        self.finish()
+    }
+
+    fn finish(&mut self) -> io::Result<()> {
+        drop(self.tx.take());
+        match self.writer.take() {
+            Some(writer) => writer
+                .join()
+                .unwrap_or_else(|_| Err(io::Error::other("journal writer panicked"))),
+            None => Ok(()),
+        }
+    }
+}
+
+impl Drop for Journal {
+    fn drop(&mut self) {
+        if let Err(err) = self.finish() {
+            eprintln!("Error closing journal: {err}");
+        }
+    }
+}
+
+fn write_record(out: &mut impl Write, payload: &[u8]) -> io::Result<()> {
+    let len = u32::try_from(payload.len())
+        .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "journal record too large"))?;
+    out.write_all(&len.to_le_bytes())?;
+    out.write_all(&crc32(payload).to_le_bytes())?;
+    out.write_all(payload)
+}
+
+/// Payloads of the whole records at the start of `buf` and the length they
+/// take up, anything past it is a torn or corrupt tail
+fn replay(buf: &[u8]) -> (Vec<Vec<u8>>, usize) {
+    let mut records = Vec::new();
+    let mut at = 0;
+    while let Some(header) = buf.get(at..at + HEADER) {
+        let len = u32::from_le_bytes(header[..4].try_into().unwrap()) as usize;
+        let crc = u32::from_le_bytes(header[4..].try_into().unwrap());
+        let Some(payload) = buf.get(at + HEADER..at + HEADER + len) else {
+            break;
+        };
+        if crc32(payload) != crc {
+            break;
+        }
+        records.push(payload.to_vec());
+        at += HEADER + len;
+    }
+    (records, at)
+}
+
+/// CRC-32 (IEEE, reflected), one table lookup per byte
+pub fn crc32(data: &[u8]) -> u32 {
+    const TABLE: [u32; 256] = {
+        let mut table = [0u32; 256];
+        let mut i = 0;
+        while i < 256 {
+            let mut c = i as u32;
+            let mut k = 0;
+            while k < 8 {
+                c = if c & 1 != 0 {
+                    0xEDB8_8320 ^ (c >> 1)
+                } else {
+                    c >> 1
+                };
+                k += 1;
+            }
+            table[i] = c;
+            i += 1;
+        }
+        table
+    };
+    !data.iter().fold(!0u32, |c, &b| {
+        TABLE[((c ^ b as u32) & 0xFF) as usize] ^ (c >> 8)
+    })
+}
@@ -1,3 +1,5 @@
+pub mod journal;
+
 #[macro_export]
 macro_rules! debug_print {
     ($($arg:tt)*) => (#[cfg(debug_assertions)] print!($($arg)*));
@@ -9,18 +9,340 @@
 #define LOGGER_ENABLED DEBUG
 #endif
 
-#define log(...)                                                               \
+enum {
+  LOG_LEVEL_TRACE = 0,
+  LOG_LEVEL_DEBUG = 1,
+  LOG_LEVEL_INFO = 2,
+  LOG_LEVEL_WARN = 3,
+  LOG_LEVEL_ERROR = 4,
+};
+
+/* Default runtime level, overridable with LOG_LEVEL=<0..4|trace|debug|...> */
+#ifndef LOG_DEFAULT_LEVEL
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_TRACE
+#endif
+
+/* Keep 1 of every N trace messages per thread, overridable with LOG_SAMPLE */
+#ifndef LOG_SAMPLE_RATE
+#define LOG_SAMPLE_RATE 1
+#endif
+
+#if LOGGER_ENABLED
+
+/*
+ * Asynchronous logger.
+ *
+ * Every logging thread formats into its own single-producer ring buffer, a
+ * background thread drains all rings to stdout. Producers never take a lock:
+ * when a ring is full the message is dropped and counted, the drain thread
+ * reports the count. Ordering is preserved per thread only.
+ */
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+/* Per-thread ring size in bytes, must be a power of two */
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE (1u << 16)
+#endif
+
+#ifndef LOG_MAX_THREADS
+#define LOG_MAX_THREADS 128
+#endif
+
+#ifndef LOG_LINE_MAX
+#define LOG_LINE_MAX 512
+#endif
+
+typedef struct {
+  _Atomic size_t head; /* producer position */
+  char _pad0[64 - sizeof(size_t)];
+  _Atomic size_t tail; /* drain position */
+  char _pad1[64 - sizeof(size_t)];
+  _Atomic uint64_t dropped;
+  unsigned char data[LOG_BUFFER_SIZE];
+} logger_ring_t;
+
+static struct {
+  _Atomic(logger_ring_t *) rings[LOG_MAX_THREADS];
+  _Atomic int nrings;
+  _Atomic int started;
+  _Atomic int stop;
+  atomic_flag draining;
+  _Atomic int level;
+  _Atomic unsigned sample_rate;
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+} logger__state = {.draining = ATOMIC_FLAG_INIT,
+                   .level = LOG_DEFAULT_LEVEL,
+                   .sample_rate = LOG_SAMPLE_RATE};
+
+static _Thread_local logger_ring_t *logger__ring;
+static _Thread_local int logger__ring_failed;
+static _Thread_local unsigned logger__sample_tick;
+
+static inline void logger__sleep(void) {
+#ifdef _WIN32
+  Sleep(1);
+#else
+  struct timespec ts = {0, 1000000};
+  nanosleep(&ts, NULL);
+#endif
+}
+
+static inline void logger__yield(void) {
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+/* Drains every registered ring once, returns number of bytes written */
+static inline size_t logger__drain(void) {
+  size_t written = 0;
+  /* Rings are single-consumer, flushing threads take turns with the drainer */
+  while (atomic_flag_test_and_set_explicit(&logger__state.draining,
+                                           memory_order_acquire))
+    logger__yield();
+
+  int n = atomic_load_explicit(&logger__state.nrings, memory_order_acquire);
+  if (n > LOG_MAX_THREADS)
+    n = LOG_MAX_THREADS;
+
+  for (int i = 0; i < n; ++i) {
+    logger_ring_t *r =
+        atomic_load_explicit(&logger__state.rings[i], memory_order_acquire);
+    if (!r)
+      continue;
+
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head != tail) {
+      size_t len = head - tail;
+      size_t off = tail & (LOG_BUFFER_SIZE - 1);
+      size_t first = LOG_BUFFER_SIZE - off;
+      if (first > len)
+        first = len;
+      fwrite(r->data + off, 1, first, stdout);
+      fwrite(r->data, 1, len - first, stdout);
+      atomic_store_explicit(&r->tail, head, memory_order_release);
+      written += len;
+    }
+
+    uint64_t dropped =
+        atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+    if (dropped) {
+      fprintf(stdout, "[LOG] thread #%d dropped %llu messages\n", i,
+              (unsigned long long)dropped);
+    }
+  }
+
+  atomic_flag_clear_explicit(&logger__state.draining, memory_order_release);
+  return written;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI logger__main(LPVOID arg) {
+#else
+static void *logger__main(void *arg) {
+#endif
+  (void)arg;
+  while (!atomic_load_explicit(&logger__state.stop, memory_order_acquire)) {
+    if (logger__drain() == 0)
+      logger__sleep();
+  }
+  logger__drain();
+  fflush(stdout);
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static inline int logger__parse_level(const char *s) {
+  static const char *names[] = {"trace", "debug", "info", "warn", "error"};
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i) {
+    if (strcmp(s, names[i]) == 0)
+      return i;
+  }
+  return atoi(s);
+}
+
+static inline void logger_shutdown(void) {
+  if (!atomic_load_explicit(&logger__state.started, memory_order_acquire))
+    return;
+  if (atomic_exchange(&logger__state.stop, 1))
+    return;
+#ifdef _WIN32
+  WaitForSingleObject(logger__state.thread, INFINITE);
+  CloseHandle(logger__state.thread);
+#else
+  pthread_join(logger__state.thread, NULL);
+#endif
+}
+
+static inline void logger__start(void) {
+  int expected = 0;
+  if (atomic_load_explicit(&logger__state.started, memory_order_relaxed) ||
+      !atomic_compare_exchange_strong(&logger__state.started, &expected, 1))
+    return;
+
+  const char *env = getenv("LOG_LEVEL");
+  if (env)
+    atomic_store(&logger__state.level, logger__parse_level(env));
+  env = getenv("LOG_SAMPLE");
+  if (env && atoi(env) > 0)
+    atomic_store(&logger__state.sample_rate, (unsigned)atoi(env));
+
+#ifdef _WIN32
+  logger__state.thread = CreateThread(NULL, 0, logger__main, NULL, 0, NULL);
+  int ok = logger__state.thread != NULL;
+#else
+  int ok = pthread_create(&logger__state.thread, NULL, logger__main, NULL) == 0;
+#endif
+  if (!ok) {
+    /* Producers see stop and fall back to synchronous printing */
+    atomic_store(&logger__state.stop, 1);
+    return;
+  }
+  atexit(logger_shutdown);
+}
+
+static inline void logger_set_level(int level) {
+  logger__start();
+  atomic_store_explicit(&logger__state.level, level, memory_order_relaxed);
+}
+
+static inline void logger_set_sample_rate(unsigned rate) {
+  logger__start();
+  atomic_store_explicit(&logger__state.sample_rate, rate ? rate : 1,
+                        memory_order_relaxed);
+}
+
+/* Cheap filter evaluated before any formatting happens */
+static inline int logger_should_log(int level) {
+  logger__start();
+  if (level < atomic_load_explicit(&logger__state.level, memory_order_relaxed))
+    return 0;
+  if (level == LOG_LEVEL_TRACE) {
+    unsigned rate =
+        atomic_load_explicit(&logger__state.sample_rate, memory_order_relaxed);
+    if (rate > 1 && logger__sample_tick++ % rate != 0)
+      return 0;
+  }
+  return 1;
+}
+
+static inline logger_ring_t *logger__thread_ring(void) {
+  if (logger__ring || logger__ring_failed)
+    return logger__ring;
+
+  int idx = atomic_fetch_add(&logger__state.nrings, 1);
+  logger_ring_t *r = NULL;
+  if (idx < LOG_MAX_THREADS)
+    r = (logger_ring_t *)calloc(1, sizeof(*r));
+  if (!r) {
+    logger__ring_failed = 1;
+    return NULL;
+  }
+
+  /* Owned by the logger for the rest of the process lifetime */
+  atomic_store_explicit(&logger__state.rings[idx], r, memory_order_release);
+  logger__ring = r;
+  return r;
+}
+
+__attribute__((format(printf, 1, 2))) static inline void
+logger_write(const char *fmt, ...) {
+  va_list args;
+  logger_ring_t *r = NULL;
+  if (!atomic_load_explicit(&logger__state.stop, memory_order_relaxed))
+    r = logger__thread_ring();
+
+  if (!r) {
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    return;
+  }
+
+  char line[LOG_LINE_MAX];
+  va_start(args, fmt);
+  int n = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (n <= 0)
+    return;
+  size_t len = (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1;
+
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  if (LOG_BUFFER_SIZE - (head - tail) < len) {
+    atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  size_t off = head & (LOG_BUFFER_SIZE - 1);
+  size_t first = LOG_BUFFER_SIZE - off;
+  if (first > len)
+    first = len;
+  memcpy(r->data + off, line, first);
+  memcpy(r->data, line + first, len - first);
+  atomic_store_explicit(&r->head, head + len, memory_order_release);
+}
+
+/* Writes everything logged so far to stdout from the calling thread */
+static inline void logger_flush(void) {
+  if (atomic_load_explicit(&logger__state.started, memory_order_acquire) &&
+      !atomic_load_explicit(&logger__state.stop, memory_order_acquire)) {
+    logger__drain();
+  }
+  fflush(stdout);
+}
+
+#define log_at(level, ...)                                                     \
   do {                                                                         \
-    if (LOGGER_ENABLED)                                                        \
-      printf(__VA_ARGS__);                                                     \
+    if (logger_should_log(level))                                              \
+      logger_write(__VA_ARGS__);                                               \
   } while (0)
 
-#define print_value(val, fmt) printf("%s = " fmt "\n", #val, (val))
+#else /* LOGGER_ENABLED == 0: arguments are still type-checked */
 
-#define log_value(val, fmt)                                                    \
+#define log_at(level, ...)                                                     \
   do {                                                                         \
-    if (LOGGER_ENABLED)                                                        \
-      print_value(val, fmt);                                                   \
+    if (0)                                                                     \
+      printf(__VA_ARGS__);                                                     \
   } while (0)
 
+static inline void logger_flush(void) {}
+
+#endif /* LOGGER_ENABLED */
+
+#define log(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_trace(...) log_at(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define log_info(...) log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#define print_value(val, fmt)                                                  \
+  (logger_flush(), printf("%s = " fmt "\n", #val, (val)))
+
+#define log_value(val, fmt)                                                    \
+  log_at(LOG_LEVEL_DEBUG, "%s = " fmt "\n", #val, (val))
+
 #endif /* LOG_UTILS_H */
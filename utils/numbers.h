@@ -2,7 +2,9 @@
 #define NUMBERS_UTILS_H
 
 #include <ctype.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 int parse_next_number(unsigned char **p, unsigned char *end, uint64_t *n) {
   while (*p < end && !isdigit(**p))
@@ -19,6 +21,44 @@ int parse_next_number(unsigned char **p, unsigned char *end, uint64_t *n) {
   return 1;
 }
 
+// Digits at *p, without skipping anything first. Up to 7 digits are read 8
+// bytes at a time (SWAR): the digit run length comes from a byte mask and the
+// digits are combined with three multiplies. Longer runs and the last bytes
+// of the buffer take the scalar loop. Returns 0 when *p is not a digit.
+int parse_uint_swar(unsigned char **p, unsigned char *end, uint64_t *n) {
+  if (end - *p >= 8) {
+    uint64_t w;
+    memcpy(&w, *p, 8);
+    // Bytes before the first non-digit are exact, later ones may be garbled
+    // by borrows, which only run towards later bytes (little endian)
+    uint64_t t = w - 0x3030303030303030ull;
+    uint64_t bad = ((t + 0x7676767676767676ull) | t) & 0x8080808080808080ull;
+    if (bad) {
+      int len = __builtin_ctzll(bad) / 8;
+      if (len == 0)
+        return 0;
+      // Move the digits to the top bytes, the zero bytes below are leading
+      // zeros of an 8 digit number
+      t <<= 64 - 8 * len;
+      t = ((t & 0x0F0F0F0F0F0F0F0Full) * 2561) >> 8;
+      t = ((t & 0x00FF00FF00FF00FFull) * 6553601) >> 16;
+      t = ((t & 0x0000FFFF0000FFFFull) * 42949672960001ull) >> 32;
+      *n = t;
+      *p += len;
+      return 1;
+    }
+  }
+  unsigned char *q = *p;
+  if (q >= end || !isdigit(*q))
+    return 0;
+  uint64_t v = 0;
+  for (; q < end && isdigit(*q); ++q)
+    v = v * 10 + (uint64_t)(*q - '0');
+  *n = v;
+  *p = q;
+  return 1;
+}
+
 int u64_to_str(uint64_t x, char *buf) {
   char tmp[21];
   int len = 0;
@@ -61,4 +101,46 @@ int u64_compare(const void* a, const void* b) {
    return (int)(*(uint64_t*)a - *(uint64_t*)b);
 }
 
+// LSD radix sort, 8 bits per pass. Passes where every key has the same byte
+// are skipped, so small keys cost only as many passes as they have bytes.
+// tmp must hold n elements, the result always ends up in a.
+void radix_sort_u64(uint64_t *a, uint64_t *tmp, size_t n) {
+  if (n < 2)
+    return;
+
+  size_t counts[8][256];
+  memset(counts, 0, sizeof(counts));
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t v = a[i];
+    for (int b = 0; b < 8; ++b) {
+      counts[b][(v >> (b * 8)) & 0xFF]++;
+    }
+  }
+
+  uint64_t *src = a;
+  uint64_t *dst = tmp;
+  for (int b = 0; b < 8; ++b) {
+    size_t *c = counts[b];
+    if (c[(src[0] >> (b * 8)) & 0xFF] == n)
+      continue;
+
+    size_t sum = 0;
+    for (int d = 0; d < 256; ++d) {
+      size_t cnt = c[d];
+      c[d] = sum;
+      sum += cnt;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t v = src[i];
+      dst[c[(v >> (b * 8)) & 0xFF]++] = v;
+    }
+    uint64_t *t = src;
+    src = dst;
+    dst = t;
+  }
+
+  if (src != a)
+    memcpy(a, src, n * sizeof(*a));
+}
+
 #endif /* ifndef NUMBERS_UTILS_H */
@@ -76,6 +76,9 @@ static inline void perf_log_elapsed(const char *label, double start_sec,
   if (sec < 0)
     sec = 0.0;
 
+  /* Keep the report after everything logged inside the measured block */
+  logger_flush();
+
   const char *unit = "ms";
   double val = sec * 1e3;
   int decimals = 4;
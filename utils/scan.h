@@ -0,0 +1,77 @@
+#ifndef SCAN_UTILS_H
+#define SCAN_UTILS_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Byte scanning over 64 byte blocks, dispatched on the CPU level: bit i of
+ * the result is set when p[i] == c. Used for line ends in day1 and for the
+ * cell bytes of text grids in bitgrid.h. The block must be readable in full.
+ */
+typedef uint64_t (*scan_byte64_fn)(const unsigned char *p, unsigned char c);
+
+static uint64_t scan__byte64_scalar(const unsigned char *p, unsigned char c) {
+  uint64_t m = 0;
+  for (int i = 0; i < 64; ++i)
+    m |= (uint64_t)(p[i] == c) << i;
+  return m;
+}
+
+#if CPU_X86
+
+CPU_TARGET_SSE2 static uint64_t scan__byte64_sse2(const unsigned char *p,
+                                                   unsigned char c) {
+  const __m128i needle = _mm_set1_epi8((char)c);
+  uint64_t m = 0;
+  for (int i = 0; i < 4; ++i) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+    m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle))
+         << (16 * i);
+  }
+  return m;
+}
+
+CPU_TARGET_AVX2 static uint64_t scan__byte64_avx2(const unsigned char *p,
+                                                   unsigned char c) {
+  const __m256i needle = _mm256_set1_epi8((char)c);
+  __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+  __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+  uint32_t mlo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle));
+  uint32_t mhi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle));
+  return ((uint64_t)mhi << 32) | mlo;
+}
+
+CPU_TARGET_AVX512 static uint64_t scan__byte64_avx512(const unsigned char *p,
+                                                       unsigned char c) {
+  return _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)p),
+                                _mm512_set1_epi8((char)c));
+}
+
+#endif /* CPU_X86 */
+
+static inline scan_byte64_fn scan__resolve_byte64(int level) {
+#if CPU_X86
+  if (level >= CPU_AVX512)
+    return scan__byte64_avx512;
+  if (level >= CPU_AVX2)
+    return scan__byte64_avx2;
+  if (level >= CPU_SSE2)
+    return scan__byte64_sse2;
+#endif
+  (void)level;
+  return scan__byte64_scalar;
+}
+
+static inline uint64_t scan_byte64(const unsigned char *p, unsigned char c) {
+  static _Atomic(scan_byte64_fn) fn;
+  scan_byte64_fn f = atomic_load_explicit(&fn, memory_order_relaxed);
+  if (!f) {
+    f = scan__resolve_byte64(cpu_level());
+    atomic_store_explicit(&fn, f, memory_order_relaxed);
+  }
+  return f(p, c);
+}
+
+#endif /* SCAN_UTILS_H */
@@ -54,20 +54,24 @@ typedef struct threadpool {
   int head;
   int tail;
   int count;
+  int active; /* tasks currently running */
   int stop;
 #ifdef _WIN32
   CRITICAL_SECTION mutex;
   CONDITION_VARIABLE cond_nonempty;
   CONDITION_VARIABLE cond_nonfull;
+  CONDITION_VARIABLE cond_idle;
 #else
   pthread_mutex_t mutex;
   pthread_cond_t cond_nonempty;
   pthread_cond_t cond_nonfull;
+  pthread_cond_t cond_idle;
 #endif
 } threadpool_t;
 
 int threadpool_init(threadpool_t *pool, int nthreads);
 int threadpool_submit(threadpool_t *pool, tp_task_fn func, void *arg);
+void threadpool_wait(threadpool_t *pool);
 void threadpool_destroy(threadpool_t *pool);
 
 static int tp_get_cpu_count(void) {
@@ -114,6 +118,7 @@ static DWORD WINAPI tp_worker_main(LPVOID arg) {
       task = pool->queue[pool->head];
       pool->head = (pool->head + 1) % TP_MAX_QUEUE;
       pool->count--;
+      pool->active++;
       WakeConditionVariable(&pool->cond_nonfull);
     }
 
@@ -122,6 +127,13 @@ static DWORD WINAPI tp_worker_main(LPVOID arg) {
     }
 
     task.func(task.arg);
+
+    MutexScope(&pool->mutex) {
+      pool->active--;
+      if (pool->count == 0 && pool->active == 0) {
+        WakeAllConditionVariable(&pool->cond_idle);
+      }
+    }
   }
 
   return 0;
@@ -150,6 +162,7 @@ static void *tp_worker_main(void *arg) {
       task = pool->queue[pool->head];
       pool->head = (pool->head + 1) % TP_MAX_QUEUE;
       pool->count--;
+      pool->active++;
       pthread_cond_signal(&pool->cond_nonfull);
     }
 
@@ -158,6 +171,13 @@ static void *tp_worker_main(void *arg) {
     }
 
     task.func(task.arg);
+
+    MutexScope(&pool->mutex) {
+      pool->active--;
+      if (pool->count == 0 && pool->active == 0) {
+        pthread_cond_broadcast(&pool->cond_idle);
+      }
+    }
   }
 
   return NULL;
@@ -186,6 +206,7 @@ int threadpool_init(threadpool_t *pool, int nthreads) {
 
   pool->nthreads = nthreads;
   pool->head = pool->tail = pool->count = 0;
+  pool->active = 0;
   pool->stop = 0;
 
 #ifdef _WIN32
@@ -193,6 +214,7 @@ int threadpool_init(threadpool_t *pool, int nthreads) {
   InitializeCriticalSection(&pool->mutex);
   InitializeConditionVariable(&pool->cond_nonempty);
   InitializeConditionVariable(&pool->cond_nonfull);
+  InitializeConditionVariable(&pool->cond_idle);
 
   for (int i = 0; i < nthreads; ++i) {
     HANDLE h = CreateThread(NULL, 0, tp_worker_main, pool, 0, NULL);
@@ -233,6 +255,13 @@ int threadpool_init(threadpool_t *pool, int nthreads) {
     return errno ? errno : -1;
   }
 
+  if (pthread_cond_init(&pool->cond_idle, NULL) != 0) {
+    pthread_cond_destroy(&pool->cond_nonfull);
+    pthread_cond_destroy(&pool->cond_nonempty);
+    pthread_mutex_destroy(&pool->mutex);
+    return errno ? errno : -1;
+  }
+
   for (int i = 0; i < nthreads; ++i) {
     int rc = pthread_create(&pool->threads[i], NULL, tp_worker_main, pool);
     if (rc != 0) {
@@ -246,6 +275,7 @@ int threadpool_init(threadpool_t *pool, int nthreads) {
         pthread_join(pool->threads[j], NULL);
       }
 
+      pthread_cond_destroy(&pool->cond_idle);
       pthread_cond_destroy(&pool->cond_nonfull);
       pthread_cond_destroy(&pool->cond_nonempty);
       pthread_mutex_destroy(&pool->mutex);
@@ -320,6 +350,30 @@ int threadpool_submit(threadpool_t *pool, tp_task_fn func, void *arg) {
 #endif /* _WIN32 */
 }
 
+/* Blocks until the queue is empty and no task is running */
+void threadpool_wait(threadpool_t *pool) {
+  if (!pool)
+    return;
+
+#ifdef _WIN32
+
+  MutexScope(&pool->mutex) {
+    while (pool->count > 0 || pool->active > 0) {
+      SleepConditionVariableCS(&pool->cond_idle, &pool->mutex, INFINITE);
+    }
+  }
+
+#else /* !_WIN32 */
+
+  MutexScope(&pool->mutex) {
+    while (pool->count > 0 || pool->active > 0) {
+      pthread_cond_wait(&pool->cond_idle, &pool->mutex);
+    }
+  }
+
+#endif /* _WIN32 */
+}
+
 void threadpool_destroy(threadpool_t *pool) {
   if (!pool)
     return;
@@ -351,6 +405,7 @@ void threadpool_destroy(threadpool_t *pool) {
     pthread_join(pool->threads[i], NULL);
   }
 
+  pthread_cond_destroy(&pool->cond_idle);
   pthread_cond_destroy(&pool->cond_nonfull);
   pthread_cond_destroy(&pool->cond_nonempty);
   pthread_mutex_destroy(&pool->mutex);
@@ -0,0 +1,86 @@
+#ifndef TRANSPOSE_UTILS_H
+#define TRANSPOSE_UTILS_H
+
+#include <stddef.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Byte matrix transpose: dst[c * dst_stride + r] = src[r * src_stride + c].
+ *
+ * The matrix is walked in TRANSPOSE_BLOCK square tiles, so both the rows
+ * being read and the rows being written stay in cache while a tile is
+ * processed. Inside a tile 16x16 blocks go through an SSE2 kernel, ragged
+ * edges are copied byte by byte.
+ */
+#ifndef TRANSPOSE_BLOCK
+#define TRANSPOSE_BLOCK 64
+#endif
+
+static inline void transpose__scalar(unsigned char *dst, size_t dst_stride,
+                                     const unsigned char *src,
+                                     size_t src_stride, size_t rows,
+                                     size_t cols) {
+  for (size_t r = 0; r < rows; ++r) {
+    for (size_t c = 0; c < cols; ++c) {
+      dst[c * dst_stride + r] = src[r * src_stride + c];
+    }
+  }
+}
+
+#if defined(__SSE2__)
+
+/*
+ * Each round interleaves vector i with vector i+8. Seen as an 8-bit index
+ * (vector:4, byte:4) that rotates the index left by one, four rounds swap
+ * vector and byte.
+ */
+static inline void transpose__16x16(unsigned char *dst, size_t dst_stride,
+                                    const unsigned char *src,
+                                    size_t src_stride) {
+  __m128i a[16], b[16];
+  for (int i = 0; i < 16; ++i)
+    a[i] = _mm_loadu_si128((const __m128i *)(src + (size_t)i * src_stride));
+  for (int round = 0; round < 4; ++round) {
+    __m128i *in = (round & 1) ? b : a;
+    __m128i *out = (round & 1) ? a : b;
+    for (int i = 0; i < 8; ++i) {
+      out[2 * i] = _mm_unpacklo_epi8(in[i], in[i + 8]);
+      out[2 * i + 1] = _mm_unpackhi_epi8(in[i], in[i + 8]);
+    }
+  }
+  for (int i = 0; i < 16; ++i)
+    _mm_storeu_si128((__m128i *)(dst + (size_t)i * dst_stride), a[i]);
+}
+
+#endif /* __SSE2__ */
+
+static inline void transpose_bytes(unsigned char *dst, size_t dst_stride,
+                                   const unsigned char *src, size_t src_stride,
+                                   size_t rows, size_t cols) {
+  for (size_t r0 = 0; r0 < rows; r0 += TRANSPOSE_BLOCK) {
+    size_t r1 = r0 + TRANSPOSE_BLOCK < rows ? r0 + TRANSPOSE_BLOCK : rows;
+    for (size_t c0 = 0; c0 < cols; c0 += TRANSPOSE_BLOCK) {
+      size_t c1 = c0 + TRANSPOSE_BLOCK < cols ? c0 + TRANSPOSE_BLOCK : cols;
+      size_t r = r0;
+#if defined(__SSE2__)
+      for (; r + 16 <= r1; r += 16) {
+        size_t c = c0;
+        for (; c + 16 <= c1; c += 16) {
+          transpose__16x16(dst + c * dst_stride + r, dst_stride,
+                           src + r * src_stride + c, src_stride);
+        }
+        transpose__scalar(dst + c * dst_stride + r, dst_stride,
+                          src + r * src_stride + c, src_stride, 16, c1 - c);
+      }
+#endif /* __SSE2__ */
+      transpose__scalar(dst + c0 * dst_stride + r, dst_stride,
+                        src + r * src_stride + c0, src_stride, r1 - r,
+                        c1 - c0);
+    }
+  }
+}
+
+#endif /* TRANSPOSE_UTILS_H */